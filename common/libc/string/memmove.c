@@ -34,10 +34,37 @@
 
 #ifdef _KERNEL
 #include <types.h>
+#include <endian.h>
 #include <lib.h>
 #else
 #include <stdint.h>
 #include <string.h>
+#ifndef HOST
+#include <sys/endian.h>
+#endif
+#endif
+
+/*
+ * Copying from a source that isn't aligned the same way as the
+ * destination reads whole aligned source words and shifts pairs of
+ * them together. Which way the shifts go depends on byte order. The
+ * host build (see testbin/memperf) takes the byte order from the
+ * compiler, since the OS/161 headers describe the target.
+ */
+#ifdef HOST
+#define WORDS_BIGENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#else
+#define WORDS_BIGENDIAN (_BYTE_ORDER == _BIG_ENDIAN)
+#endif
+
+#define WSIZE	sizeof(unsigned long)
+#define WBITS	(WSIZE * 8)
+
+/* The word starting SH bits into W0 and running on into W1. */
+#if WORDS_BIGENDIAN
+#define MERGE(w0, w1, sh) (((w0) << (sh)) | ((w1) >> (WBITS - (sh))))
+#else
+#define MERGE(w0, w1, sh) (((w0) >> (sh)) | ((w1) << (WBITS - (sh))))
 #endif
 
 /*
@@ -48,7 +75,12 @@
 void *
 memmove(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	unsigned char *d;
+	const unsigned char *s;
+	unsigned long *dw;
+	const unsigned long *sw;
+	unsigned long w0, w1, w2, w3;
+	unsigned sh;
 
 	/*
 	 * If the buffers don't overlap, it doesn't matter what direction
@@ -75,7 +107,8 @@ memmove(void *dst, const void *src, size_t len)
          *                     |___|
 	 */
 
-	if ((uintptr_t)dst < (uintptr_t)src) {
+	if ((uintptr_t)dst <= (uintptr_t)src ||
+	    (uintptr_t)dst >= (uintptr_t)src + len) {
 		/*
 		 * As author/maintainer of libc, take advantage of the
 		 * fact that we know memcpy copies forwards.
@@ -84,34 +117,67 @@ memmove(void *dst, const void *src, size_t len)
 	}
 
 	/*
-	 * Copy by words in the common case. Look in memcpy.c for more
-	 * information.
+	 * Copy back to front the same way memcpy copies front to back;
+	 * look in memcpy.c for more information. Each source word is
+	 * read before anything is written over it.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	d = (unsigned char *)dst + len;
+	s = (const unsigned char *)src + len;
 
-		long *d = dst;
-		const long *s = src;
+	if (len < 4 * WSIZE) {
+		while (len > 0) {
+			*--d = *--s;
+			len--;
+		}
+		return dst;
+	}
 
-		/*
-		 * The reason we copy index i-1 and test i>0 is that
-		 * i is unsigned -- so testing i>=0 doesn't work.
-		 */
+	while ((uintptr_t)d % WSIZE != 0) {
+		*--d = *--s;
+		len--;
+	}
+	dw = (unsigned long *)d;
 
-		for (i=len/sizeof(long); i>0; i--) {
-			d[i-1] = s[i-1];
+	if ((uintptr_t)s % WSIZE == 0) {
+		sw = (const unsigned long *)s;
+		while (len >= 4 * WSIZE) {
+			dw -= 4;
+			sw -= 4;
+			w3 = sw[3];
+			w2 = sw[2];
+			w1 = sw[1];
+			w0 = sw[0];
+			dw[3] = w3;
+			dw[2] = w2;
+			dw[1] = w1;
+			dw[0] = w0;
+			len -= 4 * WSIZE;
 		}
+		while (len >= WSIZE) {
+			*--dw = *--sw;
+			len -= WSIZE;
+		}
+		s = (const unsigned char *)sw;
 	}
 	else {
-		char *d = dst;
-		const char *s = src;
-
-		for (i=len; i>0; i--) {
-			d[i-1] = s[i-1];
+		sh = ((uintptr_t)s % WSIZE) * 8;
+		sw = (const unsigned long *)(s - (uintptr_t)s % WSIZE);
+		w1 = *sw;
+		while (len >= WSIZE) {
+			w0 = *--sw;
+			*--dw = MERGE(w0, w1, sh);
+			w1 = w0;
+			s -= WSIZE;
+			len -= WSIZE;
 		}
 	}
 
+	d = (unsigned char *)dw;
+	while (len > 0) {
+		*--d = *--s;
+		len--;
+	}
+
 	return dst;
 }
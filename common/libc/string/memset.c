@@ -31,6 +31,7 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
@@ -41,11 +42,45 @@
 void *
 memset(void *ptr, int ch, size_t len)
 {
-	char *p = ptr;
-	size_t i;
+	unsigned char *p = ptr;
+	unsigned long *pw;
+	unsigned long w;
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	/*
+	 * Store bytes until P is word-aligned, then whole words of CH
+	 * (four at a time while there's room), then the last few bytes.
+	 * ~0UL / 0xff has 1 in every byte, so multiplying by it copies
+	 * CH into every byte of a word whatever the word size.
+	 *
+	 * Short blocks aren't worth the setup.
+	 */
+
+	if (len >= 4 * sizeof(unsigned long)) {
+		while ((uintptr_t)p % sizeof(unsigned long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		w = (unsigned char)ch * (~0UL / 0xff);
+		pw = (unsigned long *)p;
+		while (len >= 4 * sizeof(unsigned long)) {
+			pw[0] = w;
+			pw[1] = w;
+			pw[2] = w;
+			pw[3] = w;
+			pw += 4;
+			len -= 4 * sizeof(unsigned long);
+		}
+		while (len >= sizeof(unsigned long)) {
+			*pw++ = w;
+			len -= sizeof(unsigned long);
+		}
+		p = (unsigned char *)pw;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
@@ -36,9 +36,15 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#define WSIZE	sizeof(unsigned long)
+#define ONES	(~0UL / 0xff)		/* 0x01 in every byte */
+#define HIGHS	(ONES << 7)		/* 0x80 in every byte */
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)	/* see strlen.c */
+
 /*
  * C standard string function: find leftmost instance of a character
  * in a string.
@@ -48,6 +54,32 @@ strchr(const char *s, int ch_arg)
 {
 	/* avoid sign-extension problems */
 	const char ch = ch_arg;
+	const unsigned long *w;
+	unsigned long chs;
+
+	/*
+	 * Check bytes until S is word-aligned, then skip whole words
+	 * that contain neither CH nor the end of the string. (XORing
+	 * with CH in every byte turns bytes equal to CH into zeros.)
+	 * Like strlen, this only reads aligned words holding part of
+	 * the string. Then find which byte it was the slow way.
+	 */
+	while ((uintptr_t)s % WSIZE != 0) {
+		if (*s == ch) {
+			return (char *)s;
+		}
+		if (*s == 0) {
+			return NULL;
+		}
+		s++;
+	}
+
+	chs = (unsigned char)ch * ONES;
+	w = (const unsigned long *)s;
+	while (!HASZERO(*w) && !HASZERO(*w ^ chs)) {
+		w++;
+	}
+	s = (const char *)w;
 
 	/* scan from left to right */
 	while (*s) {
@@ -36,9 +36,15 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#define WSIZE	sizeof(unsigned long)
+#define ONES	(~0UL / 0xff)		/* 0x01 in every byte */
+#define HIGHS	(ONES << 7)		/* 0x80 in every byte */
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)	/* see strlen.c */
+
 /*
  * Standard C string function: compare two strings and return their
  * sort order.
@@ -47,7 +53,7 @@
 int
 strcmp(const char *a, const char *b)
 {
-	size_t i;
+	const unsigned long *wa, *wb;
 
 	/*
 	 * Walk down both strings until either they're different
@@ -61,17 +67,46 @@ strcmp(const char *a, const char *b)
 	 * that we haven't run off the end of A, because that's the
 	 * same as checking to make sure we haven't run off the end of
 	 * B.
+	 *
+	 * Go a character at a time until A is word-aligned. If B is
+	 * then aligned too, go a word at a time while the words match
+	 * and A's doesn't hold its terminator; since they match, B's
+	 * doesn't either, so (see strlen.c) this never reads past a
+	 * page either string doesn't reach. Then finish a character
+	 * at a time from the word where they stopped matching. If the
+	 * strings aren't aligned alike, it's characters all the way.
 	 */
 
-	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
-		/* nothing */
+	while ((uintptr_t)a % WSIZE != 0) {
+		if (*a == 0 || *a != *b) {
+			goto done;
+		}
+		a++;
+		b++;
+	}
+
+	if ((uintptr_t)b % WSIZE == 0) {
+		wa = (const unsigned long *)a;
+		wb = (const unsigned long *)b;
+		while (*wa == *wb && !HASZERO(*wa)) {
+			wa++;
+			wb++;
+		}
+		a = (const char *)wa;
+		b = (const char *)wb;
+	}
+
+	while (*a != 0 && *a == *b) {
+		a++;
+		b++;
 	}
 
+ done:
 	/*
 	 * If A is greater than B, return 1. If A is less than B,
 	 * return -1.  If they're the same, return 0. Since we have
 	 * stopped at the first character of difference (or the end of
-	 * both strings) checking the character under I accomplishes
+	 * both strings) checking the characters there accomplishes
 	 * this.
 	 *
 	 * Note that strcmp does not handle accented characters,
@@ -80,10 +115,10 @@ strcmp(const char *a, const char *b)
 	 *
 	 * The rules say we compare order in terms of *unsigned* char.
 	 */
-	if ((unsigned char)a[i] > (unsigned char)b[i]) {
+	if ((unsigned char)*a > (unsigned char)*b) {
 		return 1;
 	}
-	else if (a[i] == b[i]) {
+	else if (*a == *b) {
 		return 0;
 	}
 	return -1;
@@ -36,28 +36,55 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#define WSIZE	sizeof(unsigned long)
+#define ONES	(~0UL / 0xff)		/* 0x01 in every byte */
+#define HIGHS	(ONES << 7)		/* 0x80 in every byte */
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)	/* see strlen.c */
+
 /*
  * Standard C string function: copy one string to another.
  */
 char *
 strcpy(char *dest, const char *src)
 {
-	size_t i;
+	char *d = dest;
+	unsigned long *dw;
+	const unsigned long *sw;
 
 	/*
-	 * Copy characters until we hit the null terminator.
+	 * Copy characters until SRC is word-aligned. If DEST is then
+	 * aligned too, copy whole words until one holds the null
+	 * terminator; only aligned words holding part of SRC are read
+	 * (see strlen.c), and words holding the terminator aren't
+	 * written, so nothing past the end of DEST's copy is touched.
 	 */
-	for (i=0; src[i]; i++) {
-		dest[i] = src[i];
+	while ((uintptr_t)src % WSIZE != 0) {
+		if ((*d++ = *src++) == 0) {
+			return dest;
+		}
+	}
+
+	if ((uintptr_t)d % WSIZE == 0) {
+		dw = (unsigned long *)d;
+		sw = (const unsigned long *)src;
+		while (!HASZERO(*sw)) {
+			*dw++ = *sw++;
+		}
+		d = (char *)dw;
+		src = (const char *)sw;
 	}
 
 	/*
-	 * Add null terminator to result.
+	 * Copy the rest (or all of it, if the alignments don't match)
+	 * a character at a time, including the null terminator.
 	 */
-	dest[i] = 0;
+	while ((*d++ = *src++) != 0) {
+		/* nothing */
+	}
 
 	return dest;
 }
@@ -36,9 +36,24 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#define WSIZE	sizeof(unsigned long)
+#define ONES	(~0UL / 0xff)		/* 0x01 in every byte */
+#define HIGHS	(ONES << 7)		/* 0x80 in every byte */
+
+/*
+ * HASZERO(w) is nonzero if and only if some byte of W is zero.
+ * Subtracting ONES sets the top bit of each byte that was zero, and
+ * of a byte that was 1 if a zero byte below it borrowed from it;
+ * masking with ~w drops bytes whose top bit was set to begin with.
+ * So it tells whether there's a zero byte but not reliably which one
+ * it is; callers find that by looking at the bytes.
+ */
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+
 /*
  * C standard string function: get length of a string
  */
@@ -46,10 +61,31 @@
 size_t
 strlen(const char *str)
 {
-	size_t ret = 0;
+	const char *p = str;
+	const unsigned long *w;
+
+	/*
+	 * Go by bytes until P is word-aligned, then check a word at a
+	 * time for a zero byte. This reads past the end of the string,
+	 * but only within the aligned word that holds its last byte,
+	 * and an aligned word is never split across two pages; so it
+	 * can't fault where a byte loop wouldn't.
+	 */
+	while ((uintptr_t)p % WSIZE != 0) {
+		if (*p == 0) {
+			return p - str;
+		}
+		p++;
+	}
+
+	w = (const unsigned long *)p;
+	while (!HASZERO(*w)) {
+		w++;
+	}
 
-	while (str[ret]) {
-		ret++;
+	p = (const char *)w;
+	while (*p) {
+		p++;
 	}
-	return ret;
+	return p - str;
 }
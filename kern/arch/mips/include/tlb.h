@@ -53,20 +53,26 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setpid: make ENTRYHI's PID field the address space ID used
+ *        for translation. (The PID in ENTRYHI is the current one, so
+ *        tlb_random, tlb_write, tlb_read, and tlb_probe all change it
+ *        as a side effect; call this afterwards to put it back.)
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setpid(uint32_t entryhi);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). An
+ * entry only matches when its PID is the current one, unless
+ * TLBLO_GLOBAL is set. The bits that aren't assigned a meaning can be
+ * left always zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +84,9 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
+#define NUM_TLBPID    64
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
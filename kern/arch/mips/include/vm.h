@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -108,11 +109,11 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space the page is in */
+	vaddr_t ts_vaddr;	/* page whose mapping is to be dropped */
 };
 
 #define TLBSHOOTDOWN_MAX 16
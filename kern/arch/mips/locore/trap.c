@@ -186,6 +186,15 @@ mips_trap(struct trapframe *tf)
 
 		mainbus_interrupt(tf);
 
+		/*
+		 * If the handler woke a thread that outranks the one
+		 * we interrupted, switch to it now instead of at the
+		 * next hardclock. Not from nested interrupts.
+		 */
+		if (!old_in) {
+			thread_check_preempt();
+		}
+
 		if (doadjust) {
 			KASSERT(curthread->t_curspl == IPL_HIGH);
 			KASSERT(curthread->t_iplhigh_count == 1);
@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -109,6 +110,22 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+#if !OPT_DUMBVM
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+			       tf->tf_a3, (const_userptr_t)(tf->tf_sp + 16),
+			       &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+#endif
+
 	    /* Add stuff here */
 
 	    default:
@@ -58,11 +58,6 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
@@ -73,14 +68,7 @@ static
 paddr_t
 getppages(unsigned long npages)
 {
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
+	return coremap_alloc(npages);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -98,22 +86,45 @@ alloc_kpages(int npages)
 void
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
 
-	(void)addr;
+/*
+ * dumbvm's pages are all wired down; there is nothing to page out.
+ */
+int
+vm_pageout(void)
+{
+	return 0;
 }
 
+/*
+ * dumbvm never changes a mapping once made, so it never asks for
+ * shootdowns itself. But they are cheap to honor, so do.
+ */
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(ts->ts_vaddr & PAGE_FRAME, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
 int
@@ -212,9 +223,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return 0;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	/* No free slot; let the hardware pick a victim. */
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	tlb_random(ehi, elo);
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -225,6 +239,7 @@ as_create(void)
 		return NULL;
 	}
 
+	as->as_cpus = 0;
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
 	as->as_npages1 = 0;
@@ -239,6 +254,15 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -256,6 +280,8 @@ as_activate(void)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	as->as_cpus |= CPUSET_BIT(curcpu->c_number);
+
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
@@ -308,13 +334,6 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return ENOSYS;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
-}
-
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -322,25 +341,21 @@ as_prepare_load(struct addrspace *as)
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
-	as->as_pbase1 = getppages(as->as_npages1);
+	as->as_pbase1 = coremap_alloc_zeroed(as->as_npages1);
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
+	as->as_pbase2 = coremap_alloc_zeroed(as->as_npages2);
 	if (as->as_pbase2 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	as->as_stackpbase = coremap_alloc_zeroed(DUMBVM_STACKPAGES);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
 
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
-
 	return 0;
 }
 
@@ -0,0 +1,736 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <synch.h>
+#include <proc.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <vm.h>
+#include <swap.h>
+#include <mmfile.h>
+#include <platform/maxcpus.h>
+
+/*
+ * MIPS side of the page-table VM system: TLB refill and the kernel
+ * page allocator. Address spaces and page tables themselves are in
+ * vm/addrspace.c and vm/pagetable.c.
+ *
+ * The TLB is loaded on demand from the page table of the current
+ * address space. A page that isn't resident yet is allocated and
+ * zero-filled on the spot, and one that has been paged out is paged
+ * back in (see vm/paging.c). Misses and evictions are counted in the
+ * process (see ps). Entries are tagged with address space IDs, so
+ * switching processes doesn't flush the TLB. Refilling the TLB for a
+ * resident page in use doesn't take the address space lock; see
+ * vm_fault_fast.
+ *
+ * Clean pages are loaded without the dirty bit even when writeable,
+ * so the first write to one comes back here as VM_FAULT_READONLY and
+ * the page can be marked dirty.
+ *
+ * Two things cut down the number of traps for sequential access.
+ * Fault-around: a TLB miss also loads the other pages of the
+ * surrounding VM_FAULTAROUND-page block that are resident and in
+ * use (PTE_REF) or freshly read ahead, so walking through a resident
+ * array traps once per block rather than once per page. Read-ahead:
+ * for file regions, faulting in pages in order maps the next pages
+ * of the file too, read with one I/O per round. The last page of
+ * each round is marked, and reaching it starts the next round, whose
+ * size adapts to how many pages of the previous round were actually
+ * used. Read-ahead pages are mapped like any others, so using them
+ * costs no more than using any resident page.
+ */
+
+/* Pages in a fault-around block; divides PT_NPTE. */
+#define VM_FAULTAROUND	4
+
+/*
+ * Address space IDs.
+ *
+ * Each cpu hands out the NUM_TLBPID address space IDs on its own, so
+ * no locking or IPIs are needed. vm_asidnext[c] is the last one cpu c
+ * handed out, with a generation number above the ID bits. An address
+ * space's as_asid[c] is good only if it is from the current
+ * generation; otherwise it is given a fresh ID when next activated
+ * on that cpu. When a cpu runs out of IDs it flushes its TLB and
+ * starts a new generation, which makes every older ID stale at once.
+ *
+ * Generation 0 is never used, so an as_asid of 0 always means "none".
+ *
+ * vm_curpid[c] is the PID field (shifted into place) that is current
+ * on cpu c; the TLB operations clobber it and it gets put back.
+ */
+#define ASID_MASK	((uint32_t)NUM_TLBPID - 1)
+#define ASID_FIRSTGEN	((uint32_t)NUM_TLBPID)
+
+static uint32_t vm_asidnext[MAXCPUS];
+static uint32_t vm_curpid[MAXCPUS];
+
+/* Read-ahead counters. */
+static struct spinlock vm_ralock = SPINLOCK_INITIALIZER;
+static unsigned vm_rapages;		/* pages read ahead */
+static unsigned vm_rahits;		/* ...that were then used */
+
+void
+vm_bootstrap(void)
+{
+	unsigned i;
+
+	/* Start at generation 1; ID 0 of it is skipped. */
+	for (i=0; i<MAXCPUS; i++) {
+		vm_asidnext[i] = ASID_FIRSTGEN;
+		vm_curpid[i] = 0;
+	}
+
+	swap_bootstrap();
+	paging_bootstrap();
+	mmfile_bootstrap();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	pa = coremap_alloc(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * TLB replacement. After a flush each cpu fills its TLB in slot
+ * order, so no valid entry is thrown out while there is still an
+ * unused slot; once every slot has been filled, misses replace a
+ * pseudo-random victim chosen by the hardware (tlb_random). Slots
+ * freed by single-page shootdowns aren't tracked, which just means
+ * they get refilled a little later. Indexed by cpu number; only
+ * touched by that cpu, at splhigh.
+ */
+static unsigned vm_tlbfilled[MAXCPUS];
+
+/*
+ * Invalidate every entry in this cpu's TLB. Must be at splhigh.
+ */
+static
+void
+vm_tlbflush(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vm_tlbfilled[curcpu->c_number] = 0;
+	tlb_setpid(vm_curpid[curcpu->c_number]);
+}
+
+/*
+ * Hand out a new address space ID on this cpu. Must be at splhigh.
+ */
+static
+uint32_t
+vm_newasid(void)
+{
+	unsigned c = curcpu->c_number;
+	uint32_t asid;
+
+	asid = vm_asidnext[c] + 1;
+	if ((asid & ASID_MASK) == 0) {
+		/*
+		 * Out of IDs. Start a new generation, which needs
+		 * the translations of the old one gone.
+		 */
+		vm_tlbflush();
+		if (asid == 0) {
+			asid = ASID_FIRSTGEN;
+		}
+	}
+	vm_asidnext[c] = asid;
+	return asid;
+}
+
+void
+vm_tlbactivate(struct addrspace *as)
+{
+	unsigned c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_number;
+	if ((as->as_asid[c] ^ vm_asidnext[c]) & ~ASID_MASK) {
+		as->as_asid[c] = vm_newasid();
+	}
+	vm_curpid[c] = (as->as_asid[c] & ASID_MASK) << TLBHI_PIDSHIFT;
+	tlb_setpid(vm_curpid[c]);
+	splx(spl);
+}
+
+/*
+ * Drop AS's translations everywhere by dropping its IDs: the old
+ * entries are left to age out, since nothing will match them again
+ * until their cpu starts a new generation and flushes. If AS is
+ * current here, it gets a new ID right away.
+ */
+void
+vm_tlbflush_as(struct addrspace *as)
+{
+	unsigned i, c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_number;
+	for (i=0; i<MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	if (as == proc_getas()) {
+		as->as_asid[c] = vm_newasid();
+		vm_curpid[c] = (as->as_asid[c] & ASID_MASK) << TLBHI_PIDSHIFT;
+		tlb_setpid(vm_curpid[c]);
+	}
+	splx(spl);
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	int spl;
+
+	spl = splhigh();
+	vm_tlbflush();
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	unsigned c;
+	uint32_t asid;
+	int i, spl;
+
+	KASSERT(ts->ts_as != NULL);
+
+	spl = splhigh();
+	c = curcpu->c_number;
+	asid = ts->ts_as->as_asid[c];
+	if (((asid ^ vm_asidnext[c]) & ~ASID_MASK) == 0) {
+		i = tlb_probe((ts->ts_vaddr & PAGE_FRAME) |
+			      ((asid & ASID_MASK) << TLBHI_PIDSHIFT), 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_setpid(vm_curpid[c]);
+	}
+	splx(spl);
+}
+
+/*
+ * Put a translation for the current address space in the TLB. If
+ * REPLACE is set there may already be an entry for the page (which
+ * must be overwritten; two matching entries are fatal on MIPS).
+ * Returns true if a valid entry for another page had to be evicted
+ * to make room.
+ */
+static
+bool
+vm_tlbload(uint32_t ehi, uint32_t elo, bool replace)
+{
+	unsigned *filled;
+	bool evicted;
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	ehi |= vm_curpid[curcpu->c_number];
+	i = replace ? tlb_probe(ehi, 0) : -1;
+	filled = &vm_tlbfilled[curcpu->c_number];
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		evicted = false;
+	}
+	else if (*filled < NUM_TLB) {
+		tlb_write(ehi, elo, *filled);
+		(*filled)++;
+		evicted = false;
+	}
+	else {
+		tlb_random(ehi, elo);
+		evicted = true;
+	}
+
+	splx(spl);
+	return evicted;
+}
+
+/*
+ * The PTE for file page PA mapped in file region RG. A private
+ * mapping maps the file's page copy-on-write, so the first write
+ * copies it.
+ */
+static
+pte_t
+vm_filepte(struct region *rg, paddr_t pa, bool writeable, bool dirty)
+{
+	if (rg->rg_flags & RG_SHARED) {
+		return pa | PTE_VALID | PTE_SHARED |
+			(writeable ? PTE_WRITE : 0) | (dirty ? PTE_DIRTY : 0);
+	}
+	return pa | PTE_VALID | (writeable ? PTE_COW : 0);
+}
+
+/*
+ * Read-ahead for file region RG, on a fault on page PAGE of it
+ * (counting from the region's base): either its first touch or the
+ * marked last page of the previous round. If this continues a
+ * sequential run, map up to rg_rawindow more pages after it, read
+ * with one I/O, and mark the last of them with PTE_RAMARK.
+ *
+ * Pages of a round are mapped with PTE_PREFETCH, which goes away the
+ * first time one is loaded into the TLB; whatever still has it when
+ * the next round starts was never used. The window doubles after a
+ * round that was all used and halves after one that was mostly
+ * wasted.
+ */
+static
+void
+vm_readahead(struct addrspace *as, struct region *rg, unsigned page)
+{
+	paddr_t pas[VM_RAMAX];
+	pte_t *ptes[VM_RAMAX];
+	unsigned issued, hits, got, n, i;
+	bool writeable;
+	pte_t *pte;
+
+	if (page != rg->rg_ranext) {
+		rg->rg_ranext = page + 1;
+		return;
+	}
+	rg->rg_ranext = page + 1;
+
+	/* How much of the last round was used? */
+	issued = rg->rg_raend - rg->rg_rastart;
+	hits = 0;
+	for (i = rg->rg_rastart; i < rg->rg_raend; i++) {
+		pte = pt_lookup(as->as_pt, rg->rg_base + i * PAGE_SIZE, false);
+		if (pte != NULL &&
+		    (*pte & (PTE_VALID | PTE_PREFETCH)) == PTE_VALID) {
+			hits++;
+		}
+	}
+	if (issued > 0) {
+		if (hits == issued) {
+			rg->rg_rawindow *= 2;
+			if (rg->rg_rawindow > VM_RAMAX) {
+				rg->rg_rawindow = VM_RAMAX;
+			}
+		}
+		else if (hits * 2 < issued) {
+			rg->rg_rawindow /= 2;
+			if (rg->rg_rawindow < VM_RAMIN) {
+				rg->rg_rawindow = VM_RAMIN;
+			}
+		}
+	}
+
+	/* The next round: the pages after this one not mapped yet. */
+	n = 0;
+	for (i = page + 1; n < rg->rg_rawindow && i < rg->rg_npages; i++) {
+		pte = pt_lookup(as->as_pt, rg->rg_base + i * PAGE_SIZE, true);
+		if (pte == NULL || *pte != 0) {
+			break;
+		}
+		ptes[n++] = pte;
+	}
+	got = 0;
+	if (n > 0 && mmfile_getpages(rg->rg_file, rg->rg_filepage + page + 1,
+				     n, pas, &got)) {
+		got = 0;
+	}
+
+	writeable = (rg->rg_flags & RG_WRITE) || as->as_loading;
+	for (i=0; i<got; i++) {
+		*ptes[i] = vm_filepte(rg, pas[i], writeable, false) |
+			PTE_PREFETCH;
+	}
+	if (got > 0) {
+		*ptes[got - 1] |= PTE_RAMARK;
+		rg->rg_ranext = page + got;
+	}
+	rg->rg_rastart = page + 1;
+	rg->rg_raend = page + 1 + got;
+
+	spinlock_acquire(&vm_ralock);
+	vm_rapages += got;
+	vm_rahits += hits;
+	spinlock_release(&vm_ralock);
+}
+
+/*
+ * Fault on the marked last page of a round of read-ahead: start the
+ * next round.
+ */
+static
+void
+vm_readahead_next(struct addrspace *as, vaddr_t faultaddress, pte_t *pte)
+{
+	struct region *rg;
+
+	*pte &= ~(pte_t)(PTE_RAMARK | PTE_PREFETCH);
+	rg = as_findregion(as, faultaddress);
+	KASSERT(rg != NULL && rg->rg_file != NULL);
+	vm_readahead(as, rg, (faultaddress - rg->rg_base) / PAGE_SIZE);
+}
+
+/*
+ * The TLB entry for a resident page.
+ */
+static
+uint32_t
+vm_tlbentry(pte_t pte)
+{
+	uint32_t elo;
+
+	elo = (pte & PTE_FRAME) | TLBLO_VALID;
+	if ((pte & (PTE_WRITE | PTE_DIRTY)) == (PTE_WRITE | PTE_DIRTY)) {
+		elo |= TLBLO_DIRTY;
+	}
+	return elo;
+}
+
+/*
+ * Fault-around: load the TLB with the other resident, recently used
+ * pages of the VM_FAULTAROUND-page block around FAULTADDRESS, whose
+ * PTE is PTE. Pages that weren't used since the pageout clock last
+ * looked are left out, so preloading can't keep them looking unused.
+ * Pages read ahead and not used yet are loaded, and count as used
+ * from then on: a sequential reader is about to get to them. A
+ * round's marked page is left to fault, since that starts the next
+ * round. Without the address space lock (LOCKED false) the PTEs can't
+ * be changed, so only pages with PTE_REF already set are loaded.
+ */
+static
+void
+vm_faultaround(vaddr_t faultaddress, pte_t *pte, bool locked)
+{
+	unsigned first, i;
+	pte_t *ptes;
+	vaddr_t va;
+
+	first = (faultaddress / PAGE_SIZE) % VM_FAULTAROUND;
+	ptes = pte - first;
+	va = faultaddress - first * PAGE_SIZE;
+	for (i=0; i<VM_FAULTAROUND; i++, va += PAGE_SIZE) {
+		if (i == first || (ptes[i] & PTE_VALID) == 0 ||
+		    (ptes[i] & PTE_RAMARK) != 0) {
+			continue;
+		}
+		if ((ptes[i] & PTE_REF) == 0) {
+			if (!locked || (ptes[i] & PTE_PREFETCH) == 0) {
+				continue;
+			}
+			ptes[i] = (ptes[i] | PTE_REF) & ~(pte_t)PTE_PREFETCH;
+		}
+		if (vm_tlbload(va, vm_tlbentry(ptes[i]), true)) {
+			curproc->p_tlbevictions++;
+		}
+		curproc->p_tlbpreloads++;
+	}
+}
+
+/*
+ * TLB refill without the address space lock, for the common case: a
+ * resident page used since the pageout clock last looked (PTE_REF)
+ * whose PTE needs no change for this access. Returns false if the
+ * slow path is needed.
+ *
+ * This only reads the page table. Its pages stay put until
+ * as_destroy, and only the process's own thread changes its PTEs,
+ * apart from vm_pageout. vm_pageout only evicts pages whose PTE_REF
+ * it found clear with the address space locked, and once cleared the
+ * bit is only set again under that lock. Before freeing a page it
+ * shoots down its TLB entries and waits for that to finish.
+ * Interrupts stay off here from reading the PTE until the entry is
+ * in the TLB. So either this sees PTE_REF clear and takes the slow
+ * path, or it read the PTE before the bit was cleared, and the
+ * shootdown comes after the entry is loaded and removes it.
+ */
+static
+bool
+vm_fault_fast(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	pte_t *pte, p;
+	int spl;
+
+	spl = splhigh();
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	p = (pte == NULL) ? 0 : *pte;
+	if ((p & (PTE_VALID | PTE_REF | PTE_RAMARK)) != (PTE_VALID | PTE_REF) ||
+	    (faulttype != VM_FAULT_READ &&
+	     (p & (PTE_WRITE | PTE_DIRTY)) != (PTE_WRITE | PTE_DIRTY))) {
+		splx(spl);
+		return false;
+	}
+	if (vm_tlbload(faultaddress, vm_tlbentry(p),
+		       faulttype == VM_FAULT_READONLY)) {
+		curproc->p_tlbevictions++;
+	}
+	if (faulttype != VM_FAULT_READONLY) {
+		vm_faultaround(faultaddress, pte, false);
+	}
+	splx(spl);
+	return true;
+}
+
+/*
+ * First touch of a page: check it's in a region the access is
+ * allowed on, then allocate it zero-filled, or for a file mapping
+ * get it from the file. Returns the PTE.
+ */
+static
+int
+vm_fault_newpage(struct addrspace *as, int faulttype, vaddr_t faultaddress,
+		 pte_t **ret)
+{
+	struct region *rg;
+	pte_t *pte;
+	paddr_t pa;
+	bool writeable;
+	unsigned page;
+	int result;
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		/* Just below the stack? Then grow the stack down to it. */
+		rg = as_growstack(as, faultaddress);
+		if (rg == NULL) {
+			return EFAULT;
+		}
+	}
+	writeable = (rg->rg_flags & RG_WRITE) || as->as_loading;
+	if (faulttype == VM_FAULT_WRITE && !writeable) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	if (rg->rg_file != NULL) {
+		page = (faultaddress - rg->rg_base) / PAGE_SIZE;
+		result = mmfile_getpage(rg->rg_file, rg->rg_filepage + page,
+					&pa);
+		if (result) {
+			return result;
+		}
+		*pte = vm_filepte(rg, pa, writeable,
+				  faulttype != VM_FAULT_READ);
+		vm_readahead(as, rg, page);
+		*ret = pte;
+		return 0;
+	}
+
+	pa = coremap_alloc_zeroed(1);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	*pte = pa | PTE_VALID | (writeable ? PTE_WRITE : 0) |
+		(faulttype == VM_FAULT_READ ? 0 : PTE_DIRTY);
+	coremap_setowner(pa, as, faultaddress);
+
+	*ret = pte;
+	return 0;
+}
+
+/*
+ * Write to a copy-on-write page: give this address space its own
+ * copy, unless nobody else is using the page any more, in which case
+ * it can just have it.
+ */
+static
+int
+vm_fault_cow(struct addrspace *as, vaddr_t faultaddress, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	oldpa = *pte & PTE_FRAME;
+	if (coremap_isshared(oldpa)) {
+		newpa = coremap_alloc(1);
+		if (newpa == 0) {
+			return ENOMEM;
+		}
+		memcpy((void *)PADDR_TO_KVADDR(newpa),
+		       (const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+		coremap_free(oldpa);
+		*pte = newpa | (*pte & ~PTE_FRAME);
+	}
+	*pte &= ~(pte_t)PTE_COW;
+	*pte |= PTE_WRITE | PTE_DIRTY;
+	coremap_setowner(*pte & PTE_FRAME, as, faultaddress);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	pte_t *pte;
+	uint32_t elo;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/*
+		 * A write to a page loaded without the dirty bit:
+		 * either copy-on-write, or not allowed at all. Sorted
+		 * out below.
+		 */
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	if (faulttype != VM_FAULT_READONLY) {
+		curproc->p_tlbmisses++;
+	}
+
+	/*
+	 * The common case: the page is resident and the PTE says
+	 * everything needed to refill the TLB.
+	 */
+	if (vm_fault_fast(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	if (pte != NULL && (*pte & PTE_SWAPPED)) {
+		result = vm_pagein(as, faultaddress, pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	if (pte == NULL || (*pte & PTE_VALID) == 0) {
+		result = vm_fault_newpage(as, faulttype, faultaddress, &pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	else if (*pte & PTE_RAMARK) {
+		vm_readahead_next(as, faultaddress, pte);
+	}
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_WRITE) == 0) {
+		if ((*pte & PTE_COW) == 0) {
+			lock_release(as->as_lock);
+			return EFAULT;
+		}
+		result = vm_fault_cow(as, faultaddress, pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	else if (faulttype != VM_FAULT_READ && (*pte & PTE_DIRTY) == 0) {
+		vm_pagedirty(pte);
+	}
+	*pte = (*pte | PTE_REF) & ~(pte_t)PTE_PREFETCH;
+
+	elo = vm_tlbentry(*pte);
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, elo & TLBLO_PPAGE);
+	if (vm_tlbload(faultaddress, elo,
+		       faulttype == VM_FAULT_READONLY)) {
+		curproc->p_tlbevictions++;
+	}
+	if (faulttype != VM_FAULT_READONLY) {
+		vm_faultaround(faultaddress, pte, true);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+void
+vm_printfaultstats(void)
+{
+	unsigned pages, hits;
+
+	spinlock_acquire(&vm_ralock);
+	pages = vm_rapages;
+	hits = vm_rahits;
+	spinlock_release(&vm_ralock);
+
+	kprintf("File read-ahead: %u pages, %u used\n", pages, hits);
+}
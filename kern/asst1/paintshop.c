@@ -107,7 +107,8 @@ void order_paint(struct paintcan *can)
 		cv_wait(cv_order_queue_full, order_queue_lock);
 	}
 	order_queue_push(order);
-	cv_signal(cv_order_queue_empty, order_queue_lock);
+	/* We block on the order right after this; hand the cpu to staff. */
+	cv_signal_handoff(cv_order_queue_empty, order_queue_lock);
 	lock_release(order_queue_lock);
 
 	// Customer waits for the order to be filled
@@ -39,6 +39,12 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Otherwise, output is appended to a ring buffer and the caller goes
+ * on its way; the device's write-done interrupt sends the next
+ * character from the ring. Writers only wait when the ring is full.
+ * Polled output drains whatever is still queued first, so it comes
+ * out in order.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -55,6 +61,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -109,15 +116,99 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Output ring. cs_outhead and cs_outtail count characters queued and
+ * taken out; they wrap freely and the difference is the number of
+ * characters waiting.
+ */
+
+#define OUTQ_MASK (CONSOLE_OUTPUT_BUFFER_SIZE - 1)
+
+/*
+ * Take the next character off the output ring. Writers that found the
+ * ring full are woken when it has drained to half full, rather than
+ * once per character.
+ */
+static
+int
+con_dequeue(struct con_softc *cs)
+{
+	int ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+	KASSERT(cs->cs_outhead != cs->cs_outtail);
+
+	ch = cs->cs_outbuf[cs->cs_outtail & OUTQ_MASK];
+	cs->cs_outtail++;
+	if (cs->cs_outhead - cs->cs_outtail ==
+	    CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_outwc, &cs->cs_outlock);
+	}
+	return ch;
+}
+
+/*
+ * If the device is idle and there's something queued, start sending.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+
+	if (cs->cs_outbusy || cs->cs_outhead == cs->cs_outtail) {
+		return;
+	}
+	cs->cs_outbusy = true;
+	cs->cs_send(cs->cs_devdata, con_dequeue(cs));
+}
+
+/*
+ * Queue LEN characters for output, sleeping while the ring is full.
+ */
+static
+void
+con_queue(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		while (cs->cs_outhead - cs->cs_outtail ==
+		       CONSOLE_OUTPUT_BUFFER_SIZE) {
+			wchan_sleep(cs->cs_outwc, &cs->cs_outlock);
+		}
+		cs->cs_outbuf[cs->cs_outhead & OUTQ_MASK] = buf[i];
+		cs->cs_outhead++;
+		con_kick(cs);
+	}
+	spinlock_release(&cs->cs_outlock);
+}
+
+//////////////////////////////////////////////////
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Anything still in the output ring goes first.
+ *
+ * If we already hold the output lock (a panic from inside the queue
+ * code, say) the ring can't be touched safely, so just print.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	if (spinlock_do_i_hold(&cs->cs_outlock)) {
+		cs->cs_sendpolled(cs->cs_devdata, ch);
+		return;
+	}
+
+	spinlock_acquire(&cs->cs_outlock);
+	while (cs->cs_outhead != cs->cs_outtail) {
+		cs->cs_sendpolled(cs->cs_devdata, con_dequeue(cs));
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -129,8 +220,9 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_queue(cs, &c, 1);
 }
 
 /*
@@ -178,13 +270,17 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next queued character, if any.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbusy = false;
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -248,12 +344,20 @@ con_lastclose(struct device *dev)
 	return 0;
 }
 
+/*
+ * Size of the chunks user writes are copied in by. Each newline
+ * becomes CR-LF, so the expanded chunk can be twice as big.
+ */
+#define CON_WCHUNK 64
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
 	char ch;
+	char wbuf[CON_WCHUNK], xbuf[2*CON_WCHUNK];
+	size_t len, xlen, i;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -284,15 +388,23 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid;
+			if (len > sizeof(wbuf)) {
+				len = sizeof(wbuf);
+			}
+			result = uiomove(wbuf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
+			xlen = 0;
+			for (i=0; i<len; i++) {
+				if (wbuf[i]=='\n') {
+					xbuf[xlen++] = '\r';
+				}
+				xbuf[xlen++] = wbuf[i];
 			}
-			putch(ch);
+			con_queue(the_console, xbuf, xlen);
 		}
 	}
 	lock_release(lk);
@@ -352,7 +464,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *outwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -372,30 +485,35 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	outwc = wchan_create("console write");
+	if (outwc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(outwc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
 
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwc = outwc;
+	cs->cs_outbusy = false;
+	cs->cs_outhead = 0;
+	cs->cs_outtail = 0;
+
 	the_console = cs;
 	con_userlock_read = rlk;
 	con_userlock_write = wlk;
@@ -30,14 +30,21 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <spinlock.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through a ring buffer: writers append to it and the
+ * device's write-done interrupt (con_start) sends the next character.
+ * The output ring size must be a power of 2.
  */
 
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -47,10 +54,16 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	struct spinlock cs_outlock;	/* protects the output fields */
+	struct wchan *cs_outwc;		/* writers waiting for space */
+	bool cs_outbusy;		/* device is sending a char */
+	unsigned cs_outhead;		/* total chars ever queued */
+	unsigned cs_outtail;		/* total chars ever sent */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
 };
 
 /*
@@ -38,6 +38,8 @@
  * of the available clocks to use, if more than one is available.
  *
  * The system will panic if gettime() is called and there is no clock.
+ * gettime_ns() instead returns 0 until a clock has been attached, so
+ * it can be used from code that runs during early boot.
  */
 
 #include <types.h>
@@ -68,3 +70,15 @@ gettime(struct timespec *ts)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, ts);
 }
+
+uint64_t
+gettime_ns(void)
+{
+	struct timespec ts;
+
+	if (the_clock == NULL) {
+		return 0;
+	}
+	the_clock->rtc_gettime(the_clock->rtc_devdata, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -843,10 +843,34 @@ emufs_namefile(struct vnode *v, struct uio *uio)
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, struct uio *uio)
 {
-	(void)v;
-	return ENOSYS;
+	struct emufs_vnode *ev = v->vn_data;
+	off_t size, endpos;
+	int result;
+
+	if (uio->uio_rw == UIO_READ) {
+		/* Past EOF reads as zeros. */
+		result = emufs_read(v, uio);
+		if (result == 0 && uio->uio_resid > 0) {
+			result = uiomovezeros(uio->uio_resid, uio);
+		}
+		return result;
+	}
+
+	/* Don't extend the file; drop whatever is past EOF. */
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		return result;
+	}
+	endpos = uio->uio_offset + uio->uio_resid;
+	if (uio->uio_offset >= size) {
+		return 0;
+	}
+	if (endpos > size) {
+		uio->uio_resid -= endpos - size;
+	}
+	return emufs_write(v, uio);
 }
 
 //////////////////////////////
@@ -1127,7 +1151,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_gettype = emufs_dir_gettype,
 	.vop_tryseek = emufs_dir_tryseek,
 	.vop_fsync = emufs_void_op_isdir,
-	.vop_mmap = emufs_void_op_isdir,
+	.vop_mmap = emufs_uio_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
 
@@ -36,9 +36,19 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <vm.h>
+#include <kmemcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * In-memory vnodes for all SFS volumes come from this cache. A struct
+ * sfs_vnode is a bit over 512 bytes because of the inode copy in it,
+ * which kmalloc would round up to 1024. Created on first use (under
+ * the vfs biglock).
+ */
+static struct kmem_cache *sfs_vnode_cache;
+
 
 /*
  * Write an on-disk inode structure back out to disk.
@@ -132,7 +142,7 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -180,7 +190,17 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	if (sfs_vnode_cache == NULL) {
+		KASSERT(vfs_biglock_do_i_hold());
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    0, NULL);
+		if (sfs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -194,7 +214,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -231,7 +251,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -242,7 +262,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		vnode_cleanup(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -255,14 +255,37 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for page I/O on a memory-mapped file. sfs_io() does the
+ * work; here we only deal with pages that run past EOF, which read
+ * as zeros and must not make the file grow when written back.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, struct uio *uio)
 {
-	(void)v;
-	return ENOSYS;
+	struct sfs_vnode *sv = v->vn_data;
+	off_t size, endpos;
+	int result;
+
+	vfs_biglock_acquire();
+	if (uio->uio_rw == UIO_WRITE) {
+		size = sv->sv_i.sfi_size;
+		endpos = uio->uio_offset + uio->uio_resid;
+		if (uio->uio_offset >= size) {
+			vfs_biglock_release();
+			return 0;
+		}
+		if (endpos > size) {
+			uio->uio_resid -= endpos - size;
+		}
+	}
+	result = sfs_io(sv, uio);
+	vfs_biglock_release();
+
+	if (result == 0 && uio->uio_rw == UIO_READ && uio->uio_resid > 0) {
+		result = uiomovezeros(uio->uio_resid, uio);
+	}
+	return result;
 }
 
 /*
@@ -662,9 +685,10 @@ sfs_off_op_isdir(struct vnode *vn, off_t a)
 
 static
 int
-sfs_mmap_isdir(struct vnode *vn)
+sfs_mmap_isdir(struct vnode *vn, struct uio *uio)
 {
 	(void)vn;
+	(void)uio;
 	return EISDIR;
 }
 
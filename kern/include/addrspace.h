@@ -36,9 +36,67 @@
 
 
 #include <vm.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagetable;
+struct mmfile;
+
+
+#if !OPT_DUMBVM
+/*
+ * A region of the address space: NPAGES pages from BASE, with the
+ * given RG_* permissions. Nothing is allocated for a region when it
+ * is defined; pages are allocated and zero-filled by vm_fault the
+ * first time they are touched. A region made by mmap of a file maps
+ * the file's pages from page FILEPAGE on instead (see mmfile.h),
+ * shared or copy-on-write according to RG_SHARED.
+ *
+ * The rg_ra* fields are vm_fault's sequential read-ahead state for
+ * file regions, in pages from BASE: the page a sequential reader
+ * would fault on next, the range read ahead last time, and how far
+ * to read ahead next time.
+ */
+struct region {
+        vaddr_t rg_base;
+        size_t rg_npages;
+        int rg_flags;
+        struct mmfile *rg_file;         /* NULL if anonymous */
+        unsigned rg_filepage;
+        unsigned rg_ranext;
+        unsigned rg_rastart, rg_raend;
+        unsigned rg_rawindow;
+        struct region *rg_next;
+};
+
+#define RG_READ         0x1
+#define RG_WRITE        0x2
+#define RG_EXEC         0x4
+#define RG_SHARED       0x8
+
+/*
+ * The user stack region starts out VM_STACKPAGES long and grows down
+ * on faults below it, up to VM_STACKMAX pages, as long as that leaves
+ * at least VM_STACKGUARD unmapped pages between it and whatever is
+ * below. The heap leaves the same gap below the stack when it grows,
+ * and mmap (MAP_FIXED included) stays out of the stack's VM_STACKMAX
+ * pages and the guard gap below them altogether.
+ */
+#define VM_STACKPAGES   16
+#define VM_STACKMAX     1024
+#define VM_STACKGUARD   16
+
+/* Where mmap starts looking for space when not given an address. */
+#define VM_MMAPBASE     0x40000000
+
+/* Read-ahead window for file regions, in pages. */
+#define VM_RAMIN        1
+#define VM_RAINITIAL    4
+#define VM_RAMAX        32
+#endif
 
 
 /*
@@ -49,6 +107,14 @@ struct vnode;
  */
 
 struct addrspace {
+        /*
+         * CPUs this address space has been active on, and so may
+         * have translations for in their TLBs. Bits are set by
+         * as_activate and never cleared; this is the target set for
+         * TLB shootdowns of the address space's mappings.
+         */
+        volatile cpuset_t as_cpus;
+
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
         paddr_t as_pbase1;
@@ -58,7 +124,21 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        /*
+         * TLB context on each cpu: the address space ID this
+         * address space uses there, tagged with the generation it
+         * was handed out in. Owned by the machine-dependent code
+         * (vm_tlbactivate) and changed only at splhigh by that cpu.
+         */
+        uint32_t as_asid[MAXCPUS];
+
+        struct lock *as_lock;           /* protects everything below */
+        struct region *as_regions;      /* list of regions */
+        struct region *as_heap;         /* heap region, if any */
+        vaddr_t as_heapend;             /* the break; in or at end of heap */
+        struct region *as_stack;        /* stack region, if any */
+        struct pagetable *as_pt;        /* resident pages */
+        bool as_loading;                /* between as_{prepare,complete}_load */
 #endif
 };
 
@@ -93,12 +173,37 @@ struct addrspace {
  *                executable into the address space.
  *
  *    as_complete_load - this is called when loading from an executable
- *                is complete.
+ *                is complete. Sets up an empty heap region after the
+ *                highest region loaded.
  *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *                The address space must be locked. (Not in dumbvm.)
+ *
+ *    as_mmap   - add a region of LEN bytes mapping the file VN from
+ *                OFFSET (or zero-filled memory, for MAP_ANON, with VN
+ *                NULL), with PROT_* and MAP_* (see <kern/mman.h>) as
+ *                for mmap(). The address is *ADDR for MAP_FIXED;
+ *                otherwise a free one is chosen. Hands back the
+ *                address in *ADDR. (Not in dumbvm.)
+ *
+ *    as_munmap - remove the regions lying within LEN bytes from
+ *                ADDR. Only whole regions can be unmapped; a range
+ *                that cuts one in two fails with EINVAL. (Not in
+ *                dumbvm.)
+ *
+ *    as_sbrk   - move the break (the end of the heap) by AMOUNT bytes,
+ *                handing back the old break in *OLDBREAK. Pages are
+ *                allocated on first touch as usual; ones no longer in
+ *                the heap after shrinking are freed. (Not in dumbvm.)
+ *
+ *    as_growstack - grow the stack region down to cover VADDR, if
+ *                that's allowed, and return it; NULL if not. The
+ *                address space must be locked. (Not in dumbvm.)
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +222,16 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int               as_mmap(struct addrspace *as, vaddr_t *addr, size_t len,
+                          int prot, int flags,
+                          struct vnode *vn, off_t offset);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+struct region    *as_growstack(struct addrspace *as, vaddr_t vaddr);
+#endif
 
 
 /*
@@ -68,6 +68,13 @@ void timerclock(void);
  */
 void gettime(struct timespec *ret);
 
+/*
+ * gettime_ns() returns the current time as a count of nanoseconds,
+ * for cheap interval measurements. It returns 0 if called before the
+ * clock device has been attached.
+ */
+uint64_t gettime_ns(void);
+
 /*
  * arithmetic on times
  *
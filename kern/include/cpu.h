@@ -36,6 +36,33 @@
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Scheduling latency histograms.
+ *
+ * Each cpu records, for every thread it switches to, how long that
+ * thread sat on the run queue, in log2 buckets of nanoseconds: bucket
+ * N counts waits of at least 2^N and less than 2^(N+1) ns (bucket 0
+ * also takes waits under 1 ns). The last bucket takes everything
+ * longer. Waits are kept separately depending on how the thread got
+ * onto the run queue.
+ */
+#define SCHEDLAT_REQUEUE	0	/* yielded, preempted, or new */
+#define SCHEDLAT_WAKEUP		1	/* woken by another thread */
+#define SCHEDLAT_INTRWAKE	2	/* woken by an interrupt handler */
+#define SCHEDLAT_NKINDS		3
+#define SCHEDLAT_NBUCKETS	32
+
+/*
+ * A set of cpus, as a bitmask indexed by c_number. This covers
+ * MAXCPUS on all supported platforms (checked in thread_bootstrap).
+ */
+typedef uint32_t cpuset_t;
+
+#define CPUSET_MAX		32
+#define CPUSET_BIT(num)		((cpuset_t)1 << (num))
+#define CPUSET_ALL		(~(cpuset_t)0)
+
+
 /*
  * Per-cpu structure
  *
@@ -61,6 +88,11 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_switches;		/* Counter of context switches */
+	uint64_t c_idletime;		/* Total ns spent in cpu_idle */
+	unsigned c_schedlat[SCHEDLAT_NKINDS][SCHEDLAT_NBUCKETS];
+	unsigned c_rt_hardclocks;	/* Real-time ticks this period */
+	bool c_rt_throttled;		/* Real-time class over quota */
 
 	/*
 	 * Accessed by other cpus.
@@ -68,6 +100,9 @@ struct cpu {
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_rtrunqueue;	/* Real-time run queue, by prio */
+	struct threadlist c_idlerunqueue; /* Idle-class run queue */
+	volatile bool c_resched;	/* Higher-prio thread is waiting */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -83,11 +118,26 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_seq counts batches of shootdown work posted to
+	 * this cpu; c_shootdown_done is the value it had when this cpu
+	 * last finished all the work posted so far. Senders that need
+	 * to wait for completion wait for done to catch up with the
+	 * seq their work was posted under.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
+	volatile unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
+
+	/*
+	 * Accessed only by this cpu: counts of TLB shootdown work this
+	 * cpu has originated, and of the IPIs it took to deliver it.
+	 */
+	unsigned c_tlbsd_requested;	/* Mappings asked to invalidate */
+	unsigned c_tlbsd_ipis;		/* IPIs actually sent */
 };
 
 #define TLBSHOOTDOWN_ALL  (-1)
@@ -153,6 +203,16 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It does not wait for the target to act on it.
+ *
+ * ipi_tlbshootdown_batch invalidates NUM mappings on every CPU in
+ * TARGETS (which may include the current CPU) and waits until they
+ * have all done so. Each target gets at most one IPI for the whole
+ * batch, and none at all if it already has one pending that hasn't
+ * been taken yet. If there are more mappings than TLBSHOOTDOWN_MAX
+ * the targets flush their whole TLB instead. It may sleep, so it
+ * must not be called from an interrupt handler or with spinlocks
+ * held.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -163,10 +223,13 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_RESCHED		4	/* Higher-priority thread is runnable */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(cpuset_t targets,
+			    const struct tlbshootdown *mappings, unsigned num);
 
 void interprocessor_interrupt(void);
 
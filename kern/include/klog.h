@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KLOG_H_
+#define _KLOG_H_
+
+/*
+ * Kernel message log (dmesg).
+ *
+ * Once the log is started, kprintf no longer writes to the console
+ * itself. Each message becomes a timestamped record in a ring buffer
+ * belonging to the cpu it was printed on. The cpu writes its own ring
+ * with interrupts off and takes no locks, so kprintf from one cpu
+ * never waits for another. A drainer thread, "klogd", merges the
+ * rings in timestamp order and passes the text on to the console.
+ *
+ * When a cpu's ring is full of text klogd has not printed yet, a
+ * kprintf caller that may sleep prints that text itself and retries.
+ * Only callers that can't block have messages cut short or dropped;
+ * drops are counted. Text already printed stays in the ring until it
+ * is overwritten, and klog_dump prints it again.
+ *
+ * klog_cpucreate is called by cpu_create to set up each cpu's ring.
+ * klog_bootstrap starts the drainer and switches kprintf over.
+ * klog_active says whether kprintf should use klog_vprintf.
+ * klog_hardclock is called on every clock tick to wake klogd.
+ * klog_drain prints everything pending now, in the caller's thread.
+ * klog_stop prints everything pending by polling and sends kprintf
+ * straight to the console again; for panic and shutdown.
+ * klog_dump prints the whole retained log (the "dmesg" command).
+ * klog_dropped returns how many messages have been cut short or lost.
+ */
+
+#include <stdarg.h>
+
+/* Size of each cpu's ring. Must be a power of 2. */
+#define KLOG_SIZE 4096
+
+void klog_cpucreate(unsigned cpunum);
+void klog_bootstrap(void);
+bool klog_active(void);
+int klog_vprintf(const char *fmt, va_list ap);
+void klog_hardclock(void);
+void klog_drain(void);
+void klog_stop(void);
+int klog_dump(void);
+unsigned klog_dropped(void);
+
+#endif /* _KLOG_H_ */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Typed object caches.
+ *
+ * A kmem_cache hands out objects of one fixed size, packed into pages
+ * at that size (rounded only for alignment) rather than rounded up to
+ * one of kmalloc's block sizes. If the cache has a constructor, it is
+ * run on each object once, when the page holding it is added to the
+ * cache; objects must be handed back to kmem_cache_free in their
+ * constructed state and come back out of kmem_cache_alloc that way,
+ * so work done by the constructor isn't repeated for every
+ * allocation.
+ *
+ * Objects can be at most KMEM_MAXSIZE bytes.
+ *
+ *    kmem_cache_create  - create a cache. NAME should be a string
+ *                         constant. ALIGN is a power of two, or 0 for
+ *                         the same alignment kmalloc gives. CTOR may
+ *                         be NULL. Returns NULL if out of memory.
+ *    kmem_cache_destroy - destroy a cache. All objects must have been
+ *                         freed.
+ *    kmem_cache_alloc   - get an object; NULL if out of memory.
+ *    kmem_cache_free    - return an object to the cache it came from.
+ *
+ *    kmem_cache_printstats - print usage of all caches, and how much
+ *                         memory they save compared to kmalloc.
+ */
+
+#define KMEM_MAXSIZE	(PAGE_SIZE / 4)
+
+struct kmem_cache;	/* Opaque. */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEMCACHE_H_ */
@@ -122,15 +122,23 @@ uint32_t random(void);
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
  *
+ * kmalloc_blocksize returns how much memory kmalloc actually uses
+ * for a request of SIZE bytes.
+ *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * Likewise kheap_printprofile and kheap_resetprofile need heap
+ * profiling enabled there.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+size_t kmalloc_blocksize(size_t size);
 void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_printprofile(void);
+void kheap_resetprofile(void);
 
 /*
  * C string functions.
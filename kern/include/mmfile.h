@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MMFILE_H_
+#define _MMFILE_H_
+
+/*
+ * Page cache for memory-mapped files.
+ *
+ * Every file that is mapped somewhere has one mmfile, found by its
+ * vnode, holding the pages of the file that have been faulted in.
+ * All mappings of the file share those physical pages: a MAP_SHARED
+ * mapping maps them directly, and a MAP_PRIVATE one maps them
+ * copy-on-write. Pages are read in with VOP_MMAP the first time any
+ * mapping touches them. Pages written through a shared mapping are
+ * marked dirty when the mapping goes away, and written back with
+ * VOP_MMAP when the last mapping of the file does; the cache lives
+ * exactly as long as the file is mapped.
+ *
+ * Functions in mmfile.c:
+ *
+ *    mmfile_bootstrap - set up; call once from vm_bootstrap.
+ *    mmfile_get       - get the mmfile for VN, creating it if the
+ *                       file isn't mapped yet, with a reference for
+ *                       the caller. Fails if VOP_MMAP says the file
+ *                       can't be mapped.
+ *    mmfile_incref    - add a reference (for a copied mapping).
+ *    mmfile_release   - drop a reference; the last one writes back
+ *                       the dirty pages and frees the cache.
+ *    mmfile_getpage   - return page INDEX of the file, reading it in
+ *                       if needed, with an extra coremap reference
+ *                       for the caller to drop with coremap_free.
+ *    mmfile_getpages  - the same for up to NPAGES pages from INDEX on,
+ *                       into PAS, reading each run of pages not yet
+ *                       cached with one VOP_MMAP. Sets *GOT to how
+ *                       many it got; fails only if that's none.
+ *    mmfile_setdirty  - note that page INDEX (which must be cached)
+ *                       was written through a shared mapping.
+ */
+
+struct vnode;
+struct mmfile;
+
+void mmfile_bootstrap(void);
+int mmfile_get(struct vnode *vn, struct mmfile **ret);
+void mmfile_incref(struct mmfile *mf);
+void mmfile_release(struct mmfile *mf);
+int mmfile_getpage(struct mmfile *mf, unsigned index, paddr_t *ret);
+int mmfile_getpages(struct mmfile *mf, unsigned index, unsigned npages,
+		    paddr_t *pas, unsigned *got);
+void mmfile_setdirty(struct mmfile *mf, unsigned index);
+
+
+#endif /* _MMFILE_H_ */
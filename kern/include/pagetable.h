@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page tables.
+ *
+ * A two-level table covering the user half of the address space: a
+ * directory of PT_NDIR pointers, each to a page of PT_NPTE page table
+ * entries, allocated only when something in its 4M span is mapped.
+ *
+ * A PTE holds the physical frame of a resident page plus flag bits;
+ * an all-zero PTE means nothing is there yet, and the page will be
+ * allocated and zero-filled on first touch. PTE_WRITE caches the
+ * region's write permission so a TLB refill of a resident page needs
+ * only the PTE. A page shared copy-on-write has PTE_COW instead of
+ * PTE_WRITE until the first write fault gives it a private copy.
+ *
+ * For paging: a page is clean (no PTE_DIRTY) if it is still all zeros
+ * or still matches its copy in swap; the TLB maps clean pages
+ * read-only so the first write can be noticed. PTE_REF is set on
+ * each TLB refill and cleared by the pageout clock. A page that has
+ * been paged out has PTE_SWAPPED and its swap slot number in place of
+ * the frame, and keeps PTE_WRITE.
+ *
+ * PTE_SHARED marks a page of a MAP_SHARED file mapping. It belongs
+ * to the file's page cache (see mmfile.h), is never paged out, and
+ * stays shared rather than becoming copy-on-write when the address
+ * space is copied.
+ *
+ * PTE_PREFETCH marks a file page mapped ahead of use by sequential
+ * read-ahead and not loaded into a TLB since; it is otherwise an
+ * ordinary resident page. PTE_RAMARK marks the last page of a round
+ * of read-ahead. Its TLB entry is never preloaded, so reaching it
+ * faults and starts the next round.
+ *
+ *    pt_create  - allocate an empty page table; NULL if out of memory.
+ *    pt_destroy - free the table itself. Does not free the pages it
+ *                 maps; the caller does that first.
+ *    pt_lookup  - return the PTE for VADDR. If the second-level page
+ *                 isn't there, allocate it if CREATE is set (NULL if
+ *                 out of memory), otherwise return NULL.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_VALID	0x00000001	/* page resident at PTE_FRAME */
+#define PTE_WRITE	0x00000002	/* page may be written */
+#define PTE_COW		0x00000004	/* shared; copy before writing */
+#define PTE_DIRTY	0x00000008	/* changed since it was last clean */
+#define PTE_REF		0x00000010	/* used since the clock last looked */
+#define PTE_SWAPPED	0x00000020	/* not resident; slot in PTE_FRAME */
+#define PTE_SHARED	0x00000040	/* page of a shared file mapping */
+#define PTE_PREFETCH	0x00000080	/* read ahead, not used yet */
+#define PTE_RAMARK	0x00000100	/* last page read ahead */
+#define PTE_FRAME	PAGE_FRAME
+
+#define PTE_SWAPSLOT(pte)	((pte) / PAGE_SIZE)
+#define PTE_MKSWAP(slot)	((pte_t)(slot) * PAGE_SIZE | PTE_SWAPPED)
+
+#define PT_NPTE		(PAGE_SIZE / sizeof(pte_t))
+#define PT_NDIR		(USERSPACETOP / (PT_NPTE * PAGE_SIZE))
+
+#define PT_DIRINDEX(va)	((va) / (PT_NPTE * PAGE_SIZE))
+#define PT_PTEINDEX(va)	(((va) / PAGE_SIZE) % PT_NPTE)
+#define PT_VADDR(d, p)	((vaddr_t)((d) * PT_NPTE + (p)) * PAGE_SIZE)
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -52,6 +52,9 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	unsigned p_tlbmisses;		/* TLB misses taken by vm_fault */
+	unsigned p_tlbevictions;	/* misses that evicted a valid entry */
+	unsigned p_tlbpreloads;		/* entries loaded by fault-around */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space and paging.
+ *
+ * Swap is the raw disk SWAP_DEVICE, divided into page-sized slots.
+ * It's optional: without it, only clean pages can be paged out.
+ *
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap  - open the swap device and start the prefetch
+ *                      thread.
+ *    swap_alloc      - allocate up to N consecutive free slots. Hands
+ *                      back the first in *SLOT and returns how many
+ *                      it got; 0 if swap is full (or missing).
+ *    swap_free       - free one slot.
+ *    swap_write      - write the N pages PAS to the N slots from SLOT,
+ *                      in one I/O.
+ *    swap_read       - read SLOT into the page PA.
+ *    swap_takecached - if SLOT has been read ahead, return the page
+ *                      holding it, which now belongs to the caller.
+ *                      Otherwise 0.
+ *    swap_prefetch   - start reading the slots after SLOT in the
+ *                      background, for swap_takecached to find.
+ *    swap_reclaim    - free every page the read-ahead cache holds
+ *                      and return how many there were.
+ *    swap_printstats - print slot usage and I/O counters.
+ *
+ * Functions in paging.c:
+ *
+ *    paging_bootstrap - allow vm_pageout to run; until then it
+ *                      doesn't.
+ *    vm_pagein       - bring back the paged-out page whose PTE is PTE,
+ *                      at VADDR in AS. AS must be locked.
+ *    vm_pagedirty    - note that the resident page whose PTE is PTE is
+ *                      about to be written, so its swap copy (if any)
+ *                      is no longer good. AS must be locked.
+ *    vm_printstats   - print memory, paging, and swap counters, with
+ *                      rates since the last call.
+ *
+ * vm_pageout is declared in vm.h.
+ */
+
+#include <pagetable.h>
+
+struct addrspace;
+
+#define SWAP_DEVICE	"lhd1raw:"
+#define SWAP_NOSLOT	((unsigned)-1)
+#define SWAP_CLUSTER	8		/* most pages written in one I/O */
+
+void swap_bootstrap(void);
+unsigned swap_alloc(unsigned n, unsigned *slot);
+void swap_free(unsigned slot);
+int swap_write(const paddr_t *pas, unsigned n, unsigned slot);
+int swap_read(paddr_t pa, unsigned slot);
+paddr_t swap_takecached(unsigned slot);
+void swap_prefetch(unsigned slot);
+unsigned swap_reclaim(void);
+void swap_printstats(void);
+
+void paging_bootstrap(void);
+int vm_pagein(struct addrspace *as, vaddr_t vaddr, pte_t *pte);
+void vm_pagedirty(pte_t *pte);
+void vm_printstats(void);
+
+
+#endif /* _SWAP_H_ */
@@ -62,6 +62,13 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * V_handoff is V for a caller that is about to block (typically on
+ * P of some other semaphore): the thread woken, if any, runs next on
+ * this CPU instead of queueing behind everything else.
+ */
+void V_handoff(struct semaphore *);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -86,6 +93,9 @@ void lock_acquire(struct lock *);
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
  *                   same time.
+ *    lock_tryacquire - Get the lock if nobody holds it (including the
+ *                   current thread) and return true; otherwise return
+ *                   false without waiting. Safe with spinlocks held.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
@@ -93,6 +103,7 @@ void lock_acquire(struct lock *);
  *
  * These operations must be atomic. You get to write them.
  */
+bool lock_tryacquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
@@ -138,5 +149,11 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_signal_handoff is cv_signal for a caller that is about to block;
+ * see V_handoff.
+ */
+void cv_signal_handoff(struct cv *cv, struct lock *lock);
+
 
 #endif /* _SYNCH_H_ */
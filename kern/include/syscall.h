@@ -58,5 +58,9 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	     const_userptr_t moreargs, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_sbrk(intptr_t amount, int32_t *retval);
 
 #endif /* _SYSCALL_H_ */
@@ -57,6 +57,8 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int pingpongbench(int, char **);
+int rttest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -70,8 +72,13 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int membench(int, char **);
+int klogtest(int, char **);
 int malloctest3(int, char **);
 int nettest(int, char **);
+int forkbench(int, char **);
+int mmapbench(int, char **);
+int pagingtest(int, char **);
 
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
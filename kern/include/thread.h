@@ -64,6 +64,33 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * Scheduling classes.
+ *
+ * Runnable real-time threads always run before normal threads on the
+ * same cpu, highest t_rtprio first and round-robin among equals. A
+ * normal thread is preempted as soon as a real-time thread becomes
+ * runnable on its cpu: at the end of the interrupt that woke it, the
+ * next wakeup operation done by the normal thread itself, or at the
+ * latest the next hardclock. To keep a runaway real-time thread from
+ * starving everything else, real-time threads are throttled (run only
+ * when no normal thread is runnable) once they have used up their
+ * share of the current period; see clock.c.
+ *
+ * Idle-class threads run only when nothing else on their cpu is
+ * runnable, and are preempted like normal threads are by real-time
+ * ones. They are for background housekeeping.
+ *
+ * Classes are listed in increasing order of precedence.
+ */
+typedef enum {
+	TC_IDLE,	/* only when there's nothing else to do */
+	TC_NORMAL,	/* ordinary round-robin */
+	TC_RT,		/* fixed-priority real-time */
+} threadclass_t;
+
+#define THREAD_RTPRIO_MAX	31	/* highest real-time priority */
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -83,6 +110,9 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_index;		/* Index into allthreads[] */
+	threadclass_t t_class;		/* Scheduling class */
+	unsigned t_rtprio;		/* Priority within TC_RT */
 
 	/*
 	 * Interrupt state fields.
@@ -101,6 +131,25 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Accounting fields, maintained by thread_switch and friends.
+	 *
+	 * Times are in nanoseconds (see gettime_ns). t_stamp is when
+	 * the thread last changed between running, runnable, and
+	 * sleeping; the time since then is charged to the matching
+	 * total at the next change. A switch is voluntary if the
+	 * thread slept or yielded on its own, and involuntary if it
+	 * was preempted from an interrupt.
+	 */
+	uint64_t t_stamp;		/* Time of last state change */
+	uint64_t t_runtime;		/* Total time running */
+	uint64_t t_waittime;		/* Total time on a run queue */
+	uint64_t t_sleeptime;		/* Total time asleep */
+	unsigned t_nvcsw;		/* Voluntary context switches */
+	unsigned t_nivcsw;		/* Involuntary context switches */
+	unsigned t_migrations;		/* Times moved to another cpu */
+	unsigned t_latkind;		/* SCHEDLAT_* for current wait */
+
 	/*
 	 * Public fields
 	 */
@@ -144,6 +193,22 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread is in the real-time scheduling
+ * class with priority RTPRIO (0 to THREAD_RTPRIO_MAX). thread_fork
+ * always makes normal-class threads.
+ */
+int thread_fork_rt(const char *name, struct proc *proc, unsigned rtprio,
+                   void (*func)(void *, unsigned long),
+                   void *data1, unsigned long data2);
+
+/*
+ * Like thread_fork, but the new thread is in the idle class.
+ */
+int thread_fork_idle(const char *name, struct proc *proc,
+                     void (*func)(void *, unsigned long),
+                     void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -168,5 +233,23 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Switch away now if a higher-priority thread has become runnable on
+ * this cpu since the current thread was picked, and it's safe to.
+ * Called on the way out of interrupt handlers and after wakeups.
+ */
+void thread_check_preempt(void);
+
+/*
+ * Print accounting information for all threads and cpus, ps-style.
+ */
+void thread_printstats(void);
+
+/*
+ * Print, or clear, the per-cpu scheduling latency histograms.
+ */
+void thread_printschedlat(void);
+void thread_resetschedlat(void);
+
 
 #endif /* _THREAD_H_ */
@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -48,9 +50,63 @@
 /* Initialization function */
 void vm_bootstrap(void);
 
+/*
+ * Physical page allocator (coremap.c).
+ *
+ *    coremap_bootstrap  - take over physical memory from ram.c; call
+ *                         right after ram_bootstrap.
+ *    coremap_alloc      - allocate NPAGES physically contiguous pages;
+ *                         returns 0 if out of memory.
+ *    coremap_alloc_zeroed - same, but zero-filled. Single pages come
+ *                         from a pool zeroed in the background.
+ *    coremap_free       - free a run returned by coremap_alloc, or
+ *                         drop one reference to a shared page.
+ *    coremap_share      - add a reference to a single page, so it
+ *                         takes one more coremap_free to free it.
+ *    coremap_isshared   - check if a page has more than one reference.
+ *    coremap_setowner   - record which address space maps a user page
+ *                         (and where), making it pageable.
+ *    coremap_setslot    - attach the swap slot holding a copy of a
+ *                         clean user page; coremap_takeslot detaches it.
+ *    coremap_victim     - run the pageout clock a few steps, up to the
+ *                         next pageable page, and mark it busy;
+ *                         coremap_unbusy undoes that if it isn't paged
+ *                         out after all.
+ *    coremap_freepages  - number of free pages.
+ *    coremap_zero_bootstrap - start the background zeroing; call once
+ *                         the thread system is up.
+ *    coremap_printstats - print free memory and zero pool counters.
+ */
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+paddr_t coremap_alloc_zeroed(unsigned long npages);
+void coremap_free(paddr_t pa);
+void coremap_share(paddr_t pa);
+bool coremap_isshared(paddr_t pa);
+void coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t vaddr);
+void coremap_setslot(paddr_t pa, unsigned slot);
+unsigned coremap_takeslot(paddr_t pa);
+paddr_t coremap_victim(bool (*claim)(struct addrspace *as, void *data),
+		       void *data, unsigned *steps,
+		       struct addrspace **as, vaddr_t *vaddr);
+void coremap_unbusy(paddr_t pa);
+unsigned coremap_freepages(void);
+void coremap_zero_bootstrap(void);
+void coremap_printstats(void);
+
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/* Print vm_fault's read-ahead counters. */
+void vm_printfaultstats(void);
+
+/*
+ * Free up some memory by paging out user pages, called by
+ * coremap_alloc when it runs out. Returns the number of pages freed;
+ * 0 if none could be (including when the caller can't sleep).
+ */
+int vm_pageout(void);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
@@ -59,5 +115,15 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * TLB context handling called from addrspace.c.
+ *
+ *    vm_tlbactivate - make AS the address space the TLB translates
+ *                     for on this cpu.
+ *    vm_tlbflush_as - discard every translation of AS on every cpu.
+ */
+void vm_tlbactivate(struct addrspace *as);
+void vm_tlbflush_as(struct addrspace *as);
+
 
 #endif /* _VM_H_ */
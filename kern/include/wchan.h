@@ -76,5 +76,13 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_wakeone, but the thread woken is queued to run next on
+ * the current CPU rather than at the back of its own CPU's run queue.
+ * Use this when the caller is about to block (e.g. V() followed by
+ * P()) so the CPU is handed straight to the woken thread.
+ */
+void wchan_wakeone_handoff(struct wchan *wc, struct spinlock *lk);
+
 
 #endif /* _WCHAN_H_ */
@@ -30,6 +30,7 @@
 
 #include <types.h>
 #include <lib.h>
+#include <klog.h>
 
 /*
  * Do a backspace in typed input.
@@ -56,6 +57,9 @@ kgets(char *buf, size_t maxlen)
 	size_t pos = 0;
 	int ch;
 
+	/* Get the prompt out of the kernel log before echoing input. */
+	klog_drain();
+
 	while (1) {
 		ch = getch();
 		if (ch=='\n' || ch=='\r') {
@@ -0,0 +1,648 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel message log. See <klog.h> for the overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <spl.h>
+#include <membar.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <wchan.h>
+#include <platform/maxcpus.h>
+#include <klog.h>
+
+#define KLOG_MASK (KLOG_SIZE - 1)
+
+/*
+ * A record is this header followed by kr_len bytes of text.
+ */
+struct klog_rec {
+	uint64_t kr_ns;			/* gettime_ns() when printed */
+	uint32_t kr_len;		/* length of the text */
+};
+#define KLOG_RECSIZE(len) (sizeof(struct klog_rec) + (len))
+
+/*
+ * One cpu's ring. Offsets count bytes ever written and wrap freely;
+ * offset X lives at kl_buf[X & KLOG_MASK].
+ *
+ * kl_head is the end of the newest complete record; only the owning
+ * cpu stores to it. kl_drained is the end of what has been printed;
+ * only the drainer stores to it. kl_start is the oldest record not
+ * yet overwritten. The owning cpu moves it forward, never past
+ * kl_drained, before it reuses the space.
+ */
+struct klog {
+	volatile unsigned kl_head;
+	volatile unsigned kl_drained;
+	volatile unsigned kl_start;
+	unsigned kl_dropped;		/* messages lost to a full ring */
+	volatile bool kl_printing;	/* drainer is partway through a record */
+
+	/* Record being written; owning cpu only. */
+	unsigned kl_len;		/* text so far */
+	bool kl_full;			/* ran out of room partway */
+
+	char *kl_buf;			/* KLOG_SIZE bytes */
+};
+
+static struct klog *klogs[MAXCPUS];
+static unsigned klog_ncpus;
+
+/* True while kprintf goes through the log. */
+static volatile bool klog_on;
+
+/* klogd sleeps here when there is nothing to print. */
+static struct spinlock klog_wakelock = SPINLOCK_INITIALIZER;
+static struct wchan *klog_wchan;
+static volatile bool klogd_asleep;
+
+/* Keeps klogd, klog_drain, and klog_dump from printing at once. */
+static struct lock *klog_drainlock;
+
+////////////////////////////////////////////////////////////
+// ring access
+
+static
+void
+klog_put(char *buf, unsigned off, const void *data, size_t len)
+{
+	const char *p = data;
+	size_t amt;
+
+	while (len > 0) {
+		amt = KLOG_SIZE - (off & KLOG_MASK);
+		if (amt > len) {
+			amt = len;
+		}
+		memcpy(buf + (off & KLOG_MASK), p, amt);
+		off += amt;
+		p += amt;
+		len -= amt;
+	}
+}
+
+static
+void
+klog_get(const char *buf, unsigned off, void *data, size_t len)
+{
+	char *p = data;
+	size_t amt;
+
+	while (len > 0) {
+		amt = KLOG_SIZE - (off & KLOG_MASK);
+		if (amt > len) {
+			amt = len;
+		}
+		memcpy(p, buf + (off & KLOG_MASK), amt);
+		off += amt;
+		p += amt;
+		len -= amt;
+	}
+}
+
+/*
+ * Print LEN bytes of a ring starting at OFF, straight to the console.
+ */
+static
+void
+klog_putch(const char *buf, unsigned off, unsigned len)
+{
+	unsigned i;
+
+	for (i=0; i<len; i++) {
+		putch(buf[(off + i) & KLOG_MASK]);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// writing
+
+/*
+ * Set up the ring for a new cpu. Called by cpu_create, before the
+ * log is switched on.
+ */
+void
+klog_cpucreate(unsigned cpunum)
+{
+	struct klog *kl;
+
+	KASSERT(cpunum < MAXCPUS);
+	KASSERT(klogs[cpunum] == NULL);
+
+	kl = kmalloc(sizeof(*kl));
+	if (kl == NULL) {
+		panic("klog: Out of memory\n");
+	}
+	kl->kl_buf = kmalloc(KLOG_SIZE);
+	if (kl->kl_buf == NULL) {
+		panic("klog: Out of memory\n");
+	}
+	kl->kl_head = 0;
+	kl->kl_drained = 0;
+	kl->kl_start = 0;
+	kl->kl_dropped = 0;
+	kl->kl_printing = false;
+	kl->kl_len = 0;
+	kl->kl_full = false;
+
+	klogs[cpunum] = kl;
+	membar_store_store();
+	if (cpunum >= klog_ncpus) {
+		klog_ncpus = cpunum + 1;
+	}
+}
+
+/*
+ * __vprintf backend: append text to the record being written. Space
+ * that has already been printed is reclaimed from the oldest record
+ * on; space that hasn't is never touched, so once the ring is full
+ * of unprinted text the rest of the message is left out and kl_full
+ * is set.
+ */
+static
+void
+klog_send(void *vkl, const char *data, size_t len)
+{
+	struct klog *kl = vkl;
+	struct klog_rec rec;
+	unsigned off, end;
+
+	if (kl->kl_full) {
+		return;
+	}
+	off = kl->kl_head + KLOG_RECSIZE(kl->kl_len);
+	if (off - kl->kl_drained >= KLOG_SIZE) {
+		kl->kl_full = true;
+		return;
+	}
+	if (len > KLOG_SIZE - (off - kl->kl_drained)) {
+		/* Keep what fits. */
+		len = KLOG_SIZE - (off - kl->kl_drained);
+		kl->kl_full = true;
+	}
+	end = off + len;
+	while (end - kl->kl_start > KLOG_SIZE) {
+		klog_get(kl->kl_buf, kl->kl_start, &rec, sizeof(rec));
+		kl->kl_start += KLOG_RECSIZE(rec.kr_len);
+	}
+	/* Readers must see kl_start move before the old text changes. */
+	membar_store_store();
+	klog_put(kl->kl_buf, off, data, len);
+	kl->kl_len += len;
+}
+
+/*
+ * Format one message into the current cpu's ring. Interrupts are off
+ * for the duration, which keeps out anything else on this cpu and
+ * keeps us from migrating; no other cpu ever writes this ring.
+ *
+ * If the message doesn't fit and MUSTFIT is set, nothing is recorded
+ * and false is returned; *WASEMPTY then says whether the ring had no
+ * unprinted text to begin with, in which case it never will fit.
+ * Otherwise whatever fits is recorded, and a short message counted.
+ */
+static
+bool
+klog_record(const char *fmt, va_list ap, bool mustfit,
+	    int *chars, bool *wasempty)
+{
+	struct klog *kl;
+	struct klog_rec rec;
+	bool fits;
+	int spl;
+
+	spl = splhigh();
+	kl = klogs[curcpu->c_number];
+
+	rec.kr_ns = gettime_ns();
+	*wasempty = kl->kl_drained == kl->kl_head;
+	kl->kl_len = 0;
+	kl->kl_full = false;
+	*chars = __vprintf(klog_send, kl, fmt, ap);
+	fits = !kl->kl_full;
+	if (!fits && mustfit) {
+		/* Leave it unpublished; the space stays free. */
+		splx(spl);
+		return false;
+	}
+	if (!fits) {
+		kl->kl_dropped++;
+	}
+	if (kl->kl_len > 0) {
+		rec.kr_len = kl->kl_len;
+		klog_put(kl->kl_buf, kl->kl_head, &rec, sizeof(rec));
+		/* The record must be complete before it is published. */
+		membar_store_store();
+		kl->kl_head += KLOG_RECSIZE(kl->kl_len);
+	}
+
+	splx(spl);
+	return fits;
+}
+
+/*
+ * kprintf through the log. A caller that may sleep never loses text
+ * to a full ring: it prints the pending text itself with klog_drain
+ * and tries again. Only callers that can't block (interrupt handlers,
+ * raised spl, spinlocks held), and messages too big for an empty
+ * ring, get cut short.
+ */
+int
+klog_vprintf(const char *fmt, va_list ap)
+{
+	va_list ap2;
+	bool canwait, fits, wasempty;
+	int chars;
+
+	canwait = !curthread->t_in_interrupt &&
+		curthread->t_curspl == 0 &&
+		curcpu->c_spinlocks == 0;
+
+	while (canwait) {
+		va_copy(ap2, ap);
+		fits = klog_record(fmt, ap2, true, &chars, &wasempty);
+		va_end(ap2);
+		if (fits) {
+			return chars;
+		}
+		if (wasempty) {
+			break;
+		}
+		klog_drain();
+	}
+
+	klog_record(fmt, ap, false, &chars, &wasempty);
+	return chars;
+}
+
+/*
+ * Total messages cut short or lost on all cpus so far.
+ */
+unsigned
+klog_dropped(void)
+{
+	unsigned i, total;
+
+	total = 0;
+	for (i=0; i<klog_ncpus; i++) {
+		total += klogs[i]->kl_dropped;
+	}
+	return total;
+}
+
+bool
+klog_active(void)
+{
+	return klog_on;
+}
+
+////////////////////////////////////////////////////////////
+// draining
+
+static
+bool
+klog_pending(void)
+{
+	unsigned i;
+
+	for (i=0; i<klog_ncpus; i++) {
+		if (klogs[i]->kl_drained != klogs[i]->kl_head) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Print the oldest unprinted record on any cpu. Returns false if
+ * there wasn't one. The caller holds klog_drainlock, or is the only
+ * thing left running.
+ */
+static
+bool
+klog_drainone(void)
+{
+	struct klog *kl, *best;
+	struct klog_rec rec, bestrec;
+	unsigned i, off;
+
+	best = NULL;
+	for (i=0; i<klog_ncpus; i++) {
+		kl = klogs[i];
+		if (kl->kl_drained == kl->kl_head) {
+			continue;
+		}
+		/* Don't read the record before seeing it published. */
+		membar_load_load();
+		klog_get(kl->kl_buf, kl->kl_drained, &rec, sizeof(rec));
+		if (best == NULL || rec.kr_ns < bestrec.kr_ns) {
+			best = kl;
+			bestrec = rec;
+		}
+	}
+	if (best == NULL) {
+		return false;
+	}
+
+	off = best->kl_drained + sizeof(bestrec);
+	best->kl_printing = true;
+	klog_putch(best->kl_buf, off, bestrec.kr_len);
+	/* Finish reading the text before giving the space back. */
+	membar_any_store();
+	best->kl_drained = off + bestrec.kr_len;
+	best->kl_printing = false;
+	return true;
+}
+
+/*
+ * The drainer thread. It sleeps when the log is empty and is woken
+ * from hardclock, so kprintf itself never has to take a lock to wake
+ * it.
+ */
+static
+void
+klogd(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		lock_acquire(klog_drainlock);
+		while (klog_drainone()) {
+			/* nothing */
+		}
+		lock_release(klog_drainlock);
+
+		spinlock_acquire(&klog_wakelock);
+		klogd_asleep = true;
+		if (!klog_pending()) {
+			wchan_sleep(klog_wchan, &klog_wakelock);
+		}
+		klogd_asleep = false;
+		spinlock_release(&klog_wakelock);
+	}
+}
+
+void
+klog_hardclock(void)
+{
+	if (!klog_on || !klogd_asleep || !klog_pending()) {
+		return;
+	}
+	spinlock_acquire(&klog_wakelock);
+	wchan_wakeone(klog_wchan, &klog_wakelock);
+	spinlock_release(&klog_wakelock);
+}
+
+/*
+ * Start the drainer and send kprintf through the log. Called once
+ * threads work and all the cpus have been created.
+ */
+void
+klog_bootstrap(void)
+{
+	int result;
+
+	klog_drainlock = lock_create("klog");
+	if (klog_drainlock == NULL) {
+		panic("klog: Could not create lock\n");
+	}
+	klog_wchan = wchan_create("klogd");
+	if (klog_wchan == NULL) {
+		panic("klog: Could not create wchan\n");
+	}
+	result = thread_fork("klogd", NULL, klogd, NULL, 0);
+	if (result) {
+		panic("klog: Could not start klogd: %s\n", strerror(result));
+	}
+
+	membar_store_store();
+	klog_on = true;
+}
+
+/*
+ * Print everything pending now rather than waiting for klogd; used
+ * before reading from the console so prompts come out first.
+ */
+void
+klog_drain(void)
+{
+	if (!klog_on) {
+		return;
+	}
+	lock_acquire(klog_drainlock);
+	while (klog_drainone()) {
+		/* nothing */
+	}
+	lock_release(klog_drainlock);
+}
+
+/*
+ * Turn the log off: kprintf goes straight to the console from here
+ * on, and whatever hasn't been printed yet is printed now, by
+ * polling. Called by panic and shutdown once the other cpus have
+ * stopped, so no lock is needed (and none could be trusted).
+ *
+ * A drainer may have been stopped partway through printing a record.
+ * That record would come out a second time in full, so the rest of it
+ * is skipped instead.
+ */
+void
+klog_stop(void)
+{
+	struct klog *kl;
+	struct klog_rec rec;
+	unsigned i;
+	int spl;
+
+	if (!klog_on) {
+		return;
+	}
+	klog_on = false;
+
+	spl = splhigh();
+	for (i=0; i<klog_ncpus; i++) {
+		kl = klogs[i];
+		if (kl->kl_printing) {
+			klog_get(kl->kl_buf, kl->kl_drained, &rec, sizeof(rec));
+			kl->kl_drained += KLOG_RECSIZE(rec.kr_len);
+			kl->kl_printing = false;
+			putch('\n');
+		}
+	}
+	while (klog_drainone()) {
+		/* nothing */
+	}
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// dmesg
+
+struct klog_snap {
+	char *ks_buf;			/* copy of the ring */
+	unsigned ks_pos;		/* next record to print */
+	unsigned ks_head;		/* end of the last record */
+};
+
+/*
+ * Copy a cpu's ring while it may still be written. The cpu moves
+ * kl_start past any record before overwriting it, so whatever lies
+ * between kl_start as read *after* the copy and kl_head as read
+ * *before* it was copied intact.
+ */
+static
+void
+klog_snapshot(struct klog *kl, struct klog_snap *ks)
+{
+	unsigned start, start2;
+
+	ks->ks_head = kl->kl_head;
+	membar_load_load();
+	start = kl->kl_start;
+	membar_load_load();
+	memcpy(ks->ks_buf, kl->kl_buf, KLOG_SIZE);
+	membar_load_load();
+	start2 = kl->kl_start;
+
+	if (start2 - start > ks->ks_head - start) {
+		/* Everything we copied has since been overwritten. */
+		ks->ks_pos = ks->ks_head;
+	}
+	else {
+		ks->ks_pos = start2;
+	}
+}
+
+/*
+ * Print the whole retained log, all cpus merged in time order, with
+ * a timestamp at the start of each line. This goes straight to the
+ * console; printing it through the log would overwrite it.
+ */
+int
+klog_dump(void)
+{
+	struct klog_snap *snaps, *best;
+	struct klog_rec rec, bestrec;
+	char prefix[32];
+	bool atline;
+	unsigned i, j, ncpus;
+	size_t k;
+
+	if (!klog_on) {
+		kprintf("klog: Log is not running\n");
+		return 0;
+	}
+
+	ncpus = klog_ncpus;
+	snaps = kmalloc(ncpus * sizeof(*snaps));
+	if (snaps == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<ncpus; i++) {
+		snaps[i].ks_buf = kmalloc(KLOG_SIZE);
+		if (snaps[i].ks_buf == NULL) {
+			while (i-- > 0) {
+				kfree(snaps[i].ks_buf);
+			}
+			kfree(snaps);
+			return ENOMEM;
+		}
+	}
+
+	lock_acquire(klog_drainlock);
+	while (klog_drainone()) {
+		/* nothing */
+	}
+	for (i=0; i<ncpus; i++) {
+		klog_snapshot(klogs[i], &snaps[i]);
+	}
+
+	atline = true;
+	while (1) {
+		best = NULL;
+		for (i=0; i<ncpus; i++) {
+			if (snaps[i].ks_pos == snaps[i].ks_head) {
+				continue;
+			}
+			klog_get(snaps[i].ks_buf, snaps[i].ks_pos,
+				 &rec, sizeof(rec));
+			if (best == NULL || rec.kr_ns < bestrec.kr_ns) {
+				best = &snaps[i];
+				bestrec = rec;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+
+		best->ks_pos += sizeof(bestrec);
+		for (j=0; j<bestrec.kr_len; j++) {
+			if (atline) {
+				snprintf(prefix, sizeof(prefix),
+					 "[%5llu.%06lu] ",
+					 (unsigned long long)
+					 (bestrec.kr_ns / 1000000000),
+					 (unsigned long)
+					 (bestrec.kr_ns % 1000000000) / 1000);
+				for (k=0; prefix[k]; k++) {
+					putch(prefix[k]);
+				}
+			}
+			klog_putch(best->ks_buf, best->ks_pos + j, 1);
+			atline = best->ks_buf[(best->ks_pos + j) & KLOG_MASK]
+				== '\n';
+		}
+		best->ks_pos += bestrec.kr_len;
+	}
+	if (!atline) {
+		putch('\n');
+	}
+	lock_release(klog_drainlock);
+
+	for (i=0; i<ncpus; i++) {
+		if (klogs[i]->kl_dropped > 0) {
+			kprintf("klog: cpu%u: %u messages cut short or lost\n",
+				i, klogs[i]->kl_dropped);
+		}
+		kfree(snaps[i].ks_buf);
+	}
+	kfree(snaps);
+	return 0;
+}
@@ -38,11 +38,17 @@
 #include <synch.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
+#include <klog.h>
 
 
 /* Flags word for DEBUG() macro. */
 uint32_t dbflags = 0;
 
+/*
+ * Once the kernel log is running, kprintf writes into it instead and
+ * these locks are not used; see klog.c.
+ */
+
 /* Lock for non-polled kprintfs */
 static struct lock *kprintf_lock;
 
@@ -98,6 +104,13 @@ kprintf(const char *fmt, ...)
 	va_list ap;
 	bool dolock;
 
+	if (klog_active()) {
+		va_start(ap, fmt);
+		chars = klog_vprintf(fmt, ap);
+		va_end(ap);
+		return chars;
+	}
+
 	dolock = kprintf_lock != NULL
 		&& curthread->t_in_interrupt == false
 		&& curthread->t_curspl == 0
@@ -164,6 +177,9 @@ panic(const char *fmt, ...)
 
 		/* Kill off other threads and halt other CPUs. */
 		thread_panic();
+
+		/* Print what's still in the kernel log, by polling. */
+		klog_stop();
 	}
 
 	if (evil == 2) {
@@ -46,6 +46,7 @@
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
+#include <klog.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
@@ -108,6 +109,7 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	coremap_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
@@ -126,7 +128,9 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	coremap_zero_bootstrap();
 	kprintf_bootstrap();
+	klog_bootstrap();
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -158,6 +162,9 @@ shutdown(void)
 	thread_shutdown();
 
 	splhigh();
+
+	/* The other cpus are gone; print the rest of the log by polling. */
+	klog_stop();
 }
 
 /*****************************************/
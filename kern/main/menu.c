@@ -40,9 +40,12 @@
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
+#include <swap.h>
+#include <klog.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 #include <test.h>  // potentially depend on opt-* above 
 
 /*
@@ -404,6 +407,77 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printprofile();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheap_resetprofile();
+	}
+	else {
+		kprintf("Usage: khprof [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_dmesg(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	return klog_dump();
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_schedlat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_printschedlat();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_resetschedlat();
+	}
+	else {
+		kprintf("Usage: schedlat [reset]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -475,6 +549,15 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
+	"[ppb] Ping-pong handoff benchmark   ",
+	"[rtt] Real-time scheduling test     ",
+	"[memb] memcpy/memset benchmark      ",
+	"[klt] Kernel log burst test [lines] ",
+#if !OPT_DUMBVM
+	"[fb]  Fork (as_copy) benchmark      ",
+	"[mmb] mmap vs. read benchmark       ",
+	"[pgt] Paging test [pages]           ",
+#endif
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -508,6 +591,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profile [reset]",
+	"[ps] Thread and cpu accounting      ",
+#if !OPT_DUMBVM
+	"[vmstat] Paging and swap stats      ",
+#endif
+	"[schedlat] Scheduler latency [reset]",
+	"[dmesg] Kernel message log          ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -564,6 +654,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+	{ "ps",         cmd_ps },
+#if !OPT_DUMBVM
+	{ "vmstat",     cmd_vmstat },
+#endif
+	{ "schedlat",   cmd_schedlat },
+	{ "dmesg",      cmd_dmesg },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -583,6 +680,17 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "ppb",	pingpongbench },
+	{ "rtt",	rttest },
+	{ "memb",	membench },
+	{ "klt",	klogtest },
+
+#if !OPT_DUMBVM
+	/* VM assignment tests */
+	{ "fb",		forkbench },
+	{ "mmb",	mmapbench },
+	{ "pgt",	pagingtest },
+#endif
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
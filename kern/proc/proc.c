@@ -78,6 +78,9 @@ proc_create(const char *name)
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_tlbmisses = 0;
+	proc->p_tlbevictions = 0;
+	proc->p_tlbpreloads = 0;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * mmap(), munmap(), and sbrk().
+ *
+ * Only anonymous mappings can be made from user level so far: there
+ * is no per-process file table yet to turn a file handle into a
+ * vnode, so mapping a file fails with EBADF. In-kernel users can map
+ * files with as_mmap directly.
+ */
+
+/*
+ * mmap has six arguments; the last two (the file handle, and the
+ * 64-bit offset, which is 8-aligned) come on the user stack, from
+ * MOREARGS.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	 const_userptr_t moreargs, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	int fd;
+	off_t offset;
+	int result;
+
+	result = copyin(moreargs, &fd, sizeof(fd));
+	if (result) {
+		return result;
+	}
+	result = copyin(moreargs + 8, &offset, sizeof(offset));
+	if (result) {
+		return result;
+	}
+
+	if ((flags & MAP_ANON) == 0) {
+		return EBADF;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	vaddr = (vaddr_t)addr;
+	result = as_mmap(as, &vaddr, len, prot, flags, NULL, offset);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)vaddr;
+	return 0;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * sbrk moves the end of the heap by AMOUNT bytes and returns the old
+ * end. New heap pages are zero-filled on first touch, like any others.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Fork benchmark.
+ *
+ * Measures what fork and exit cost the VM system, as a function of
+ * the size of the process: an address space with a given number of
+ * resident pages is copied with as_copy and the copy destroyed again
+ * with as_destroy. With copy-on-write this should barely depend on
+ * the size. For comparison the same is timed with the parent writing
+ * every page between the two, which forces every page to be copied.
+ *
+ * There is no fork system call yet, so this runs in the kernel: the
+ * menu thread borrows the address space being copied, which is safe
+ * because kernel threads don't otherwise touch user addresses.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <test.h>
+
+#define FB_BASE		0x10000000
+#define FB_DEFMAXPAGES	256
+#define FB_ROUNDS	20
+
+/*
+ * Write one word to each of the first NPAGES pages of the current
+ * address space.
+ */
+static
+int
+fb_touch(unsigned npages)
+{
+	unsigned i;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		result = copyout(&i, (userptr_t)(FB_BASE + i * PAGE_SIZE),
+				 sizeof(i));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Fork and exit ROUNDS times; if WRITE, write every page in between.
+ * Returns the average time per round in nanoseconds.
+ */
+static
+int
+fb_run(struct addrspace *as, unsigned npages, bool write, uint64_t *ret)
+{
+	struct addrspace *child;
+	uint64_t before;
+	unsigned i;
+	int result;
+
+	before = gettime_ns();
+	for (i=0; i<FB_ROUNDS; i++) {
+		result = as_copy(as, &child);
+		if (result) {
+			return result;
+		}
+		if (write) {
+			result = fb_touch(npages);
+			if (result) {
+				as_destroy(child);
+				return result;
+			}
+		}
+		as_destroy(child);
+	}
+	*ret = (gettime_ns() - before) / FB_ROUNDS;
+	return 0;
+}
+
+static
+int
+fb_size(unsigned npages)
+{
+	struct addrspace *as, *oldas;
+	uint64_t forkns, writens;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, FB_BASE, npages * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+
+	oldas = proc_setas(as);
+	as_activate();
+
+	result = fb_touch(npages);
+	if (!result) {
+		result = fb_run(as, npages, false, &forkns);
+	}
+	if (!result) {
+		result = fb_run(as, npages, true, &writens);
+	}
+
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+
+	if (result) {
+		return result;
+	}
+	kprintf("%6u pages: fork+exit %8llu ns, "
+		"fork+write all+exit %10llu ns\n", npages,
+		(unsigned long long)forkns, (unsigned long long)writens);
+	return 0;
+}
+
+int
+forkbench(int nargs, char **args)
+{
+	unsigned npages, maxpages;
+	int n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: fb [maxpages]\n");
+		return EINVAL;
+	}
+	maxpages = FB_DEFMAXPAGES;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("fb: maxpages must be positive\n");
+			return EINVAL;
+		}
+		maxpages = n;
+	}
+
+	kprintf("Starting fork benchmark...\n");
+	for (npages = 1; npages <= maxpages; npages *= 4) {
+		result = fb_size(npages);
+		if (result) {
+			kprintf("fb: %u pages: %s\n", npages, strerror(result));
+			return result;
+		}
+	}
+	kprintf("Fork benchmark done.\n");
+	return 0;
+}
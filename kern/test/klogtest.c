@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel log burst test.
+ *
+ * Several threads each kprintf a numbered run of lines, together far
+ * more than a cpu's log ring holds, the way a big ps or kh listing
+ * does. Since they can all sleep, none of it may be cut short: the
+ * test fails if the log's dropped-message count goes up. The lines
+ * themselves can be checked on the console, or afterwards with dmesg.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <klog.h>
+#include <test.h>
+
+#define KLT_THREADS	4
+#define KLT_DEFLINES	200
+
+static struct semaphore *klt_donesem;
+
+static
+void
+klt_thread(void *junk, unsigned long num)
+{
+	unsigned long lines = (unsigned long)junk;
+	unsigned long i;
+
+	for (i=0; i<lines; i++) {
+		kprintf("klt: thread %lu line %4lu of %4lu "
+			"..................................\n",
+			num, i+1, lines);
+	}
+	V(klt_donesem);
+}
+
+int
+klogtest(int nargs, char **args)
+{
+	unsigned long lines;
+	unsigned before, after;
+	int i, n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: klt [lines]\n");
+		return EINVAL;
+	}
+	lines = KLT_DEFLINES;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("klt: lines must be positive\n");
+			return EINVAL;
+		}
+		lines = n;
+	}
+	if (!klog_active()) {
+		kprintf("klt: Kernel log is not running\n");
+		return 0;
+	}
+
+	klt_donesem = sem_create("klt", 0);
+	if (klt_donesem == NULL) {
+		panic("klt: sem_create failed\n");
+	}
+
+	before = klog_dropped();
+	for (i=0; i<KLT_THREADS; i++) {
+		result = thread_fork("klt", NULL, klt_thread,
+				     (void *)lines, i);
+		if (result) {
+			panic("klt: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<KLT_THREADS; i++) {
+		P(klt_donesem);
+	}
+	klog_drain();
+	after = klog_dropped();
+
+	sem_destroy(klt_donesem);
+	klt_donesem = NULL;
+
+	if (after != before) {
+		kprintf("klt: FAILED: %u messages cut short or lost\n",
+			after - before);
+		return 0;
+	}
+	kprintf("klt: %lu lines from %d threads, none lost. "
+		"Test passed.\n", lines * KLT_THREADS, KLT_THREADS);
+	return 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel memcpy/memmove/memset benchmark.
+ *
+ * Times the kernel's memcpy, memmove, and memset against simple
+ * reference versions (what libc had before: whole words only when
+ * everything is word-aligned, bytes otherwise) over a range of sizes
+ * and alignments, after checking that they agree. These are what
+ * uiomove, copyin/copyout, and as_copy spend their time in.
+ *
+ * The same measurements for userland (and the host) are in
+ * testbin/memperf.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <test.h>
+
+#define MB_MAXSIZE	32768
+#define MB_SLOP		16
+#define MB_BUFSIZE	(MB_MAXSIZE + 2*MB_SLOP)
+
+static const size_t mb_sizes[] = { 8, 64, 512, 4096, MB_MAXSIZE };
+#define MB_NSIZES (sizeof(mb_sizes) / sizeof(mb_sizes[0]))
+
+/* Destination and source offsets from word alignment. */
+static const unsigned mb_aligns[][2] = {
+	{ 0, 0 },
+	{ 1, 1 },
+	{ 0, 1 },
+	{ 3, 2 },
+};
+#define MB_NALIGNS (sizeof(mb_aligns) / sizeof(mb_aligns[0]))
+
+static
+void *
+ref_memcpy(void *dst, const void *src, size_t len)
+{
+	size_t i;
+
+	if ((uintptr_t)dst % sizeof(long) == 0 &&
+	    (uintptr_t)src % sizeof(long) == 0 &&
+	    len % sizeof(long) == 0) {
+		long *d = dst;
+		const long *s = src;
+
+		for (i=0; i<len/sizeof(long); i++) {
+			d[i] = s[i];
+		}
+	}
+	else {
+		char *d = dst;
+		const char *s = src;
+
+		for (i=0; i<len; i++) {
+			d[i] = s[i];
+		}
+	}
+	return dst;
+}
+
+static
+void *
+ref_memmove(void *dst, const void *src, size_t len)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t i;
+
+	if ((uintptr_t)dst < (uintptr_t)src) {
+		return ref_memcpy(dst, src, len);
+	}
+	for (i=len; i>0; i--) {
+		d[i-1] = s[i-1];
+	}
+	return dst;
+}
+
+static
+void *
+ref_memset(void *ptr, int ch, size_t len)
+{
+	char *p = ptr;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = ch;
+	}
+	return ptr;
+}
+
+static
+void
+mb_fill(unsigned char *buf, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<MB_BUFSIZE; i++) {
+		buf[i] = (unsigned char)(seed + i * 7 + (i >> 8));
+	}
+}
+
+static
+bool
+mb_differ(const unsigned char *a, const unsigned char *b)
+{
+	size_t i;
+
+	for (i=0; i<MB_BUFSIZE; i++) {
+		if (a[i] != b[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Run both versions and compare the whole buffers, so that writes
+ * outside the range show up too. Returns nonzero on mismatch.
+ */
+static
+int
+mb_check(unsigned char *src, unsigned char *dst, unsigned char *ref,
+	 size_t size, unsigned doff, unsigned soff)
+{
+	mb_fill(src, 1);
+	mb_fill(dst, 2);
+	mb_fill(ref, 2);
+	memcpy(dst + doff, src + soff, size);
+	ref_memcpy(ref + doff, src + soff, size);
+	if (mb_differ(dst, ref)) {
+		kprintf("memcpy: wrong result for size %u, offsets %u/%u\n",
+			size, doff, soff);
+		return 1;
+	}
+
+	memmove(dst + doff, dst + soff, size);
+	ref_memmove(ref + doff, ref + soff, size);
+	if (mb_differ(dst, ref)) {
+		kprintf("memmove: wrong result for size %u, offsets %u/%u\n",
+			size, doff, soff);
+		return 1;
+	}
+
+	memset(dst + doff, soff, size);
+	ref_memset(ref + doff, soff, size);
+	if (mb_differ(dst, ref)) {
+		kprintf("memset: wrong result for size %u, offset %u\n",
+			size, doff);
+		return 1;
+	}
+	return 0;
+}
+
+static
+uint64_t
+mb_elapsed(const struct timespec *before)
+{
+	struct timespec after, duration;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	return (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+}
+
+static
+unsigned long
+mb_copy(void *(*fn)(void *, const void *, size_t),
+	void *dst, const void *src, size_t size, unsigned long iters)
+{
+	struct timespec before;
+	unsigned long i;
+	uint64_t ns;
+
+	gettime(&before);
+	for (i=0; i<iters; i++) {
+		fn(dst, src, size);
+	}
+	ns = mb_elapsed(&before);
+	/* MB/s */
+	return (unsigned long)((uint64_t)iters * size * 1000 / (ns ? ns : 1));
+}
+
+static
+unsigned long
+mb_set(void *(*fn)(void *, int, size_t),
+       void *dst, size_t size, unsigned long iters)
+{
+	struct timespec before;
+	unsigned long i;
+	uint64_t ns;
+
+	gettime(&before);
+	for (i=0; i<iters; i++) {
+		fn(dst, (int)i, size);
+	}
+	ns = mb_elapsed(&before);
+	return (unsigned long)((uint64_t)iters * size * 1000 / (ns ? ns : 1));
+}
+
+int
+membench(int nargs, char **args)
+{
+	unsigned char *src, *dst, *ref;
+	unsigned long kb, iters;
+	unsigned i, j, doff, soff;
+	size_t size;
+	int bad;
+
+	if (nargs > 2) {
+		kprintf("Usage: memb [kbytes]\n");
+		return EINVAL;
+	}
+	kb = 256;
+	if (nargs == 2) {
+		kb = atoi(args[1]);
+		if (kb == 0) {
+			kprintf("memb: kbytes must be positive\n");
+			return EINVAL;
+		}
+	}
+
+	src = kmalloc(MB_BUFSIZE);
+	dst = kmalloc(MB_BUFSIZE);
+	ref = kmalloc(MB_BUFSIZE);
+	if (src == NULL || dst == NULL || ref == NULL) {
+		kfree(src);
+		kfree(dst);
+		kfree(ref);
+		return ENOMEM;
+	}
+
+	kprintf("Checking memcpy, memmove, and memset...\n");
+	bad = 0;
+	for (i=0; i<MB_NSIZES && !bad; i++) {
+		for (doff=0; doff<MB_SLOP && !bad; doff++) {
+			for (soff=0; soff<MB_SLOP && !bad; soff++) {
+				bad = mb_check(src, dst, ref, mb_sizes[i],
+					       doff, soff);
+			}
+		}
+	}
+	if (bad) {
+		kfree(src);
+		kfree(dst);
+		kfree(ref);
+		return EINVAL;
+	}
+
+	kprintf("Timing %lu KB per measurement:\n", kb);
+	kprintf("%-8s %6s %5s %9s %9s\n",
+		"", "size", "align", "old MB/s", "new MB/s");
+	for (i=0; i<MB_NSIZES; i++) {
+		size = mb_sizes[i];
+		iters = kb * 1024 / size;
+		if (iters == 0) {
+			iters = 1;
+		}
+		for (j=0; j<MB_NALIGNS; j++) {
+			doff = mb_aligns[j][0];
+			soff = mb_aligns[j][1];
+			kprintf("%-8s %6u   %u/%u %9lu %9lu\n", "memcpy",
+				size, doff, soff,
+				mb_copy(ref_memcpy, dst + doff, src + soff,
+					size, iters),
+				mb_copy(memcpy, dst + doff, src + soff,
+					size, iters));
+		}
+		/* Overlapping, so memmove has to go backwards. */
+		doff = MB_SLOP/2 + 1;
+		kprintf("%-8s %6u   %u/%u %9lu %9lu\n", "memmove",
+			size, doff, 0,
+			mb_copy(ref_memmove, dst + doff, dst, size, iters),
+			mb_copy(memmove, dst + doff, dst, size, iters));
+		for (doff=0; doff<2; doff++) {
+			kprintf("%-8s %6u   %u   %9lu %9lu\n", "memset",
+				size, doff,
+				mb_set(ref_memset, dst + doff, size, iters),
+				mb_set(memset, dst + doff, size, iters));
+		}
+	}
+	kprintf("memb done.\n");
+
+	kfree(src);
+	kfree(dst);
+	kfree(ref);
+	return 0;
+}
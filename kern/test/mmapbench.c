@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmap benchmark.
+ *
+ * Compares reading a file through a memory mapping with reading it
+ * with VOP_READ into a buffer, the way read() does, for sequential
+ * and for random access. Each pass sums every word of every page it
+ * visits, so both do the same work on the data; the difference is
+ * how the data gets there. The mapping is remade for each pass so
+ * both start with nothing cached. Afterwards a MAP_SHARED mapping is
+ * written through and unmapped, and the file read back to check the
+ * changes reached it.
+ *
+ * Like the fork benchmark this runs in the kernel, borrowing an
+ * address space for the mapping; the mapped pages are read straight
+ * through their user addresses, and faulted in by vm_fault just as
+ * they would be for a user program.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <limits.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <test.h>
+
+#define MB_DEFFILE	"emu0:mmapbench.dat"
+#define MB_DEFPAGES	128
+#define MB_WORDS	(PAGE_SIZE / sizeof(uint32_t))
+
+/* What each word of the file starts out as. */
+#define MB_PATTERN(page, word)	((page) * 0x10001 + (word))
+
+static uint32_t *mb_buf;
+
+/*
+ * Page I/O on the file with VOP_READ/VOP_WRITE, like read()/write().
+ */
+static
+int
+mb_io(struct vnode *vn, unsigned page, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	uio_kinit(&iov, &u, mb_buf, PAGE_SIZE, (off_t)page * PAGE_SIZE, rw);
+	result = (rw == UIO_READ) ? VOP_READ(vn, &u) : VOP_WRITE(vn, &u);
+	if (result == 0 && u.uio_resid > 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+static
+uint32_t
+mb_sum(const volatile uint32_t *words)
+{
+	uint32_t sum = 0;
+	unsigned i;
+
+	for (i=0; i<MB_WORDS; i++) {
+		sum += words[i];
+	}
+	return sum;
+}
+
+/*
+ * The page to visit on step I of a pass: in order, or pseudo-random.
+ */
+static
+unsigned
+mb_page(bool random, unsigned i, unsigned npages)
+{
+	if (!random) {
+		return i;
+	}
+	return (i * 2654435761U + 12345) % npages;
+}
+
+static
+int
+mb_readpass(struct vnode *vn, unsigned npages, bool random, uint32_t *sum)
+{
+	unsigned i;
+	int result;
+
+	*sum = 0;
+	for (i=0; i<npages; i++) {
+		result = mb_io(vn, mb_page(random, i, npages), UIO_READ);
+		if (result) {
+			return result;
+		}
+		*sum += mb_sum(mb_buf);
+	}
+	return 0;
+}
+
+static
+int
+mb_mmappass(struct addrspace *as, struct vnode *vn, unsigned npages,
+	    bool random, uint32_t *sum)
+{
+	const volatile uint32_t *base;
+	vaddr_t va;
+	unsigned i;
+	int result;
+
+	va = 0;
+	result = as_mmap(as, &va, npages * PAGE_SIZE, PROT_READ, MAP_PRIVATE,
+			 vn, 0);
+	if (result) {
+		return result;
+	}
+	base = (const volatile uint32_t *)va;
+
+	*sum = 0;
+	for (i=0; i<npages; i++) {
+		*sum += mb_sum(base + mb_page(random, i, npages) * MB_WORDS);
+	}
+
+	return as_munmap(as, va, npages * PAGE_SIZE);
+}
+
+static
+int
+mb_compare(struct addrspace *as, struct vnode *vn, unsigned npages,
+	   bool random)
+{
+	uint64_t before, readns, mmapns;
+	uint32_t readsum, mmapsum;
+	int result;
+
+	before = gettime_ns();
+	result = mb_readpass(vn, npages, random, &readsum);
+	if (result) {
+		return result;
+	}
+	readns = gettime_ns() - before;
+
+	before = gettime_ns();
+	result = mb_mmappass(as, vn, npages, random, &mmapsum);
+	if (result) {
+		return result;
+	}
+	mmapns = gettime_ns() - before;
+
+	kprintf("%-10s read %10llu ns  mmap %10llu ns%s\n",
+		random ? "random" : "sequential",
+		(unsigned long long)readns, (unsigned long long)mmapns,
+		readsum == mmapsum ? "" : "  (CHECKSUMS DIFFER)");
+	return 0;
+}
+
+/*
+ * Write one word per page through a shared mapping, unmap it, and
+ * check the file has the new words.
+ */
+static
+int
+mb_writeback(struct addrspace *as, struct vnode *vn, unsigned npages)
+{
+	vaddr_t va;
+	uint32_t word;
+	unsigned i, bad;
+	int result;
+
+	va = 0;
+	result = as_mmap(as, &va, npages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, vn, 0);
+	if (result) {
+		return result;
+	}
+	for (i=0; i<npages; i++) {
+		word = ~MB_PATTERN(i, 0);
+		result = copyout(&word, (userptr_t)(va + i * PAGE_SIZE),
+				 sizeof(word));
+		if (result) {
+			as_munmap(as, va, npages * PAGE_SIZE);
+			return result;
+		}
+	}
+	result = as_munmap(as, va, npages * PAGE_SIZE);
+	if (result) {
+		return result;
+	}
+
+	bad = 0;
+	for (i=0; i<npages; i++) {
+		result = mb_io(vn, i, UIO_READ);
+		if (result) {
+			return result;
+		}
+		if (mb_buf[0] != ~MB_PATTERN(i, 0) ||
+		    mb_buf[1] != MB_PATTERN(i, 1)) {
+			bad++;
+		}
+	}
+	kprintf("MAP_SHARED write-back: %u of %u pages wrong\n", bad, npages);
+	return bad ? EIO : 0;
+}
+
+static
+int
+mb_run(struct vnode *vn, unsigned npages)
+{
+	struct addrspace *as, *oldas;
+	unsigned i, j;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		for (j=0; j<MB_WORDS; j++) {
+			mb_buf[j] = MB_PATTERN(i, j);
+		}
+		result = mb_io(vn, i, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	oldas = proc_setas(as);
+	as_activate();
+
+	result = mb_compare(as, vn, npages, false);
+	if (!result) {
+		result = mb_compare(as, vn, npages, true);
+	}
+	if (!result) {
+		result = mb_writeback(as, vn, npages);
+	}
+
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	return result;
+}
+
+int
+mmapbench(int nargs, char **args)
+{
+	char path[PATH_MAX];
+	const char *name;
+	struct vnode *vn;
+	unsigned npages;
+	int n, result;
+
+	if (nargs > 3) {
+		kprintf("Usage: mmb [file [pages]]\n");
+		return EINVAL;
+	}
+	name = nargs > 1 ? args[1] : MB_DEFFILE;
+	if (strlen(name) >= sizeof(path)) {
+		return ENAMETOOLONG;
+	}
+	/* vfs_open wants a path it can scribble on. */
+	strcpy(path, name);
+	npages = MB_DEFPAGES;
+	if (nargs > 2) {
+		n = atoi(args[2]);
+		if (n <= 0) {
+			kprintf("mmb: pages must be positive\n");
+			return EINVAL;
+		}
+		npages = n;
+	}
+
+	mb_buf = kmalloc(PAGE_SIZE);
+	if (mb_buf == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(path, O_RDWR | O_CREAT | O_TRUNC, 0664, &vn);
+	if (result) {
+		kprintf("mmb: %s: %s\n", name, strerror(result));
+		kfree(mb_buf);
+		return result;
+	}
+
+	kprintf("Starting mmap benchmark: %u pages...\n", npages);
+	result = mb_run(vn, npages);
+	if (result) {
+		kprintf("mmb: %s\n", strerror(result));
+	}
+	else {
+		kprintf("mmap benchmark done.\n");
+	}
+
+	vfs_close(vn);
+	kfree(mb_buf);
+	mb_buf = NULL;
+	return result;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Paging test.
+ *
+ * One address space with more pages than there is free memory: every
+ * page is written with a pattern and then read back, twice over. The
+ * only process holding memory is the one faulting, so this passes
+ * only if vm_pageout will evict the pages of the address space whose
+ * fault it was called from. Needs a swap disk, since the pages are
+ * all dirty.
+ *
+ * Like the fork benchmark this runs in the kernel, borrowing an
+ * address space; the pages are written and read with copyout and
+ * copyin through their user addresses, so they are faulted in by
+ * vm_fault just as they would be for a user program.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <test.h>
+
+#define PGT_BASE	0x10000000
+#define PGT_PASSES	2
+
+/*
+ * The word written at the start and end of page PAGE in pass PASS.
+ */
+static
+uint32_t
+pgt_pattern(unsigned page, unsigned pass)
+{
+	return 0x5a000000 ^ (pass << 20) ^ page;
+}
+
+static
+int
+pgt_write(unsigned npages, unsigned pass)
+{
+	uint32_t word;
+	vaddr_t va;
+	unsigned i;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		word = pgt_pattern(i, pass);
+		va = PGT_BASE + i * PAGE_SIZE;
+		result = copyout(&word, (userptr_t)va, sizeof(word));
+		if (!result) {
+			result = copyout(&word, (userptr_t)(va + PAGE_SIZE -
+					 sizeof(word)), sizeof(word));
+		}
+		if (result) {
+			kprintf("pgt: writing page %u: %s\n", i,
+				strerror(result));
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+int
+pgt_check(unsigned npages, unsigned pass)
+{
+	uint32_t first, last;
+	vaddr_t va;
+	unsigned i;
+	int result;
+
+	for (i=0; i<npages; i++) {
+		va = PGT_BASE + i * PAGE_SIZE;
+		result = copyin((const_userptr_t)va, &first, sizeof(first));
+		if (!result) {
+			result = copyin((const_userptr_t)(va + PAGE_SIZE -
+					sizeof(last)), &last, sizeof(last));
+		}
+		if (result) {
+			kprintf("pgt: reading page %u: %s\n", i,
+				strerror(result));
+			return result;
+		}
+		if (first != pgt_pattern(i, pass) ||
+		    last != pgt_pattern(i, pass)) {
+			kprintf("pgt: page %u: found 0x%x/0x%x, "
+				"expected 0x%x\n", i, first, last,
+				pgt_pattern(i, pass));
+			return EIO;
+		}
+	}
+	return 0;
+}
+
+int
+pagingtest(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	unsigned npages, pass;
+	int n, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: pgt [pages]\n");
+		return EINVAL;
+	}
+	npages = coremap_freepages() + coremap_freepages() / 2;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("pgt: pages must be positive\n");
+			return EINVAL;
+		}
+		npages = n;
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, PGT_BASE, npages * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+
+	oldas = proc_setas(as);
+	as_activate();
+
+	kprintf("Starting paging test: %u pages, %u free...\n", npages,
+		coremap_freepages());
+	result = 0;
+	for (pass = 0; pass < PGT_PASSES && !result; pass++) {
+		result = pgt_write(npages, pass);
+		if (!result) {
+			result = pgt_check(npages, pass);
+		}
+	}
+
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+
+	if (result) {
+		kprintf("pgt: FAILED\n");
+		return result;
+	}
+	kprintf("Paging test done.\n");
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Ping-pong benchmark.
+ *
+ * Two threads bounce control back and forth through a pair of
+ * semaphores, each doing V() on the other's semaphore and then
+ * immediately P() on its own. This is the wakeup-then-block pattern
+ * the handoff wakeup (V_handoff) is meant for, so the benchmark runs
+ * once with plain V() and once with V_handoff() and reports the
+ * average round-trip time of each.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define PP_DEFROUNDS	2000
+
+static struct semaphore *ping;
+static struct semaphore *pong;
+static struct semaphore *donesem;
+static bool pp_handoff;
+
+static
+void
+pp_wake(struct semaphore *sem)
+{
+	if (pp_handoff) {
+		V_handoff(sem);
+	}
+	else {
+		V(sem);
+	}
+}
+
+static
+void
+pingthread(void *junk, unsigned long rounds)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<rounds; i++) {
+		pp_wake(ping);
+		P(pong);
+	}
+	V(donesem);
+}
+
+static
+void
+pongthread(void *junk, unsigned long rounds)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<rounds; i++) {
+		P(ping);
+		pp_wake(pong);
+	}
+	V(donesem);
+}
+
+static
+void
+pp_run(bool handoff, unsigned long rounds)
+{
+	struct timespec before, after, duration;
+	uint64_t ns;
+	int result;
+
+	pp_handoff = handoff;
+
+	gettime(&before);
+
+	result = thread_fork("pong", NULL, pongthread, NULL, rounds);
+	if (result) {
+		panic("pingpong: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("ping", NULL, pingthread, NULL, rounds);
+	if (result) {
+		panic("pingpong: thread_fork failed: %s\n", strerror(result));
+	}
+	P(donesem);
+	P(donesem);
+
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	ns = (uint64_t)duration.tv_sec * 1000000000 + duration.tv_nsec;
+	kprintf("%-8s %lu round trips in %llu.%09lu s, %lu ns each\n",
+		handoff ? "handoff" : "plain", rounds,
+		(unsigned long long) duration.tv_sec,
+		(unsigned long) duration.tv_nsec,
+		(unsigned long)(ns / rounds));
+}
+
+int
+pingpongbench(int nargs, char **args)
+{
+	unsigned long rounds;
+	int n;
+
+	if (nargs > 2) {
+		kprintf("Usage: ppb [rounds]\n");
+		return EINVAL;
+	}
+	rounds = PP_DEFROUNDS;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("ppb: rounds must be positive\n");
+			return EINVAL;
+		}
+		rounds = n;
+	}
+
+	ping = sem_create("ping", 0);
+	pong = sem_create("pong", 0);
+	donesem = sem_create("ppdone", 0);
+	if (ping == NULL || pong == NULL || donesem == NULL) {
+		panic("pingpong: sem_create failed\n");
+	}
+
+	kprintf("Starting ping-pong benchmark...\n");
+	pp_run(false, rounds);
+	pp_run(true, rounds);
+	kprintf("Ping-pong benchmark done.\n");
+
+	sem_destroy(ping);
+	sem_destroy(pong);
+	sem_destroy(donesem);
+	ping = pong = donesem = NULL;
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Real-time scheduling class test.
+ *
+ * Starts a few normal-class threads that just burn cpu, then measures
+ * how long it takes a thread blocked on a semaphore to actually start
+ * running after being woken, first for a normal-class waiter and then
+ * for a real-time one. The real-time waiter should be scheduled right
+ * away; the normal one has to wait its turn behind the hogs.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define RT_NHOGS	4
+#define RT_ROUNDS	50
+
+static struct semaphore *rt_go;
+static struct semaphore *rt_back;
+static struct semaphore *rt_donesem;
+static volatile bool rt_stop;
+static volatile uint64_t rt_wokeat;
+
+static
+void
+rt_hogthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!rt_stop) {
+		/* spin */
+	}
+	V(rt_donesem);
+}
+
+static
+void
+rt_waiterthread(void *junk, unsigned long rounds)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<rounds; i++) {
+		P(rt_go);
+		rt_wokeat = gettime_ns();
+		V(rt_back);
+	}
+	V(rt_donesem);
+}
+
+static
+void
+rt_run(bool rt, unsigned long rounds)
+{
+	uint64_t start, total, max, lat;
+	unsigned long i;
+	int result;
+
+	if (rt) {
+		result = thread_fork_rt("rtwaiter", NULL, THREAD_RTPRIO_MAX,
+					rt_waiterthread, NULL, rounds);
+	}
+	else {
+		result = thread_fork("waiter", NULL,
+				     rt_waiterthread, NULL, rounds);
+	}
+	if (result) {
+		panic("rttest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	total = max = 0;
+	for (i=0; i<rounds; i++) {
+		start = gettime_ns();
+		V(rt_go);
+		P(rt_back);
+		lat = rt_wokeat - start;
+		total += lat;
+		if (lat > max) {
+			max = lat;
+		}
+	}
+	P(rt_donesem);
+
+	kprintf("%-8s wakeup latency: avg %llu us, max %llu us\n",
+		rt ? "rt" : "normal",
+		(unsigned long long)(total / rounds / 1000),
+		(unsigned long long)(max / 1000));
+}
+
+int
+rttest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	rt_go = sem_create("rtgo", 0);
+	rt_back = sem_create("rtback", 0);
+	rt_donesem = sem_create("rtdone", 0);
+	if (rt_go == NULL || rt_back == NULL || rt_donesem == NULL) {
+		panic("rttest: sem_create failed\n");
+	}
+
+	kprintf("Starting real-time scheduling test...\n");
+
+	rt_stop = false;
+	for (i=0; i<RT_NHOGS; i++) {
+		result = thread_fork("rthog", NULL, rt_hogthread, NULL, i);
+		if (result) {
+			panic("rttest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	rt_run(false, RT_ROUNDS);
+	rt_run(true, RT_ROUNDS);
+
+	rt_stop = true;
+	for (i=0; i<RT_NHOGS; i++) {
+		P(rt_donesem);
+	}
+
+	kprintf("Real-time scheduling test done.\n");
+
+	sem_destroy(rt_go);
+	sem_destroy(rt_back);
+	sem_destroy(rt_donesem);
+	rt_go = rt_back = rt_donesem = NULL;
+
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <klog.h>
 
 /*
  * Time handling.
@@ -53,6 +54,14 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+/*
+ * Real-time throttling: in each period of RT_PERIOD_HARDCLOCKS, the
+ * real-time class on a cpu gets at most RT_RUNTIME_HARDCLOCKS of it
+ * before normal threads are allowed to go first again.
+ */
+#define RT_PERIOD_HARDCLOCKS	HZ			/* One second */
+#define RT_RUNTIME_HARDCLOCKS	(HZ - HZ / 20)		/* 95% of that */
+
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
@@ -97,6 +106,15 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curthread->t_class == TC_RT &&
+	    ++curcpu->c_rt_hardclocks >= RT_RUNTIME_HARDCLOCKS) {
+		curcpu->c_rt_throttled = true;
+	}
+	if ((curcpu->c_hardclocks % RT_PERIOD_HARDCLOCKS) == 0) {
+		curcpu->c_rt_hardclocks = 0;
+		curcpu->c_rt_throttled = false;
+	}
+	klog_hardclock();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
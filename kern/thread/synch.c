@@ -120,6 +120,19 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * After waking someone up, give up the cpu if they outrank us. Not
+ * from interrupt handlers; mips_trap does that on the way out.
+ */
+static
+void
+synch_preempt(void)
+{
+	if (!curthread->t_in_interrupt) {
+		thread_check_preempt();
+	}
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -132,6 +145,22 @@ V(struct semaphore *sem)
 	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
 
 	spinlock_release(&sem->sem_lock);
+	synch_preempt();
+}
+
+void
+V_handoff(struct semaphore *sem)
+{
+        KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+
+        sem->sem_count++;
+        KASSERT(sem->sem_count > 0);
+	wchan_wakeone_handoff(sem->sem_wchan, &sem->sem_lock);
+
+	spinlock_release(&sem->sem_lock);
+	synch_preempt();
 }
 
 ////////////////////////////////////////////////////////////
@@ -196,6 +225,23 @@ lock_acquire(struct lock *lock)
 	spinlock_release(&lock->lk_lock);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool ret;
+
+	DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	ret = (lock->lk_holder == NULL);
+	if (ret) {
+		lock->lk_holder = curthread;
+	}
+	spinlock_release(&lock->lk_lock);
+
+	return ret;
+}
+
 void
 lock_release(struct lock *lock)
 {
@@ -206,6 +252,7 @@ lock_release(struct lock *lock)
 	lock->lk_holder = NULL;
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 	spinlock_release(&lock->lk_lock);
+	synch_preempt();
 }
 
 bool
@@ -291,6 +338,7 @@ cv_signal(struct cv *cv, struct lock *lock)
 	spinlock_acquire(&cv->cv_wchanlock);
 	wchan_wakeone(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
+	synch_preempt();
 }
 
 void
@@ -300,4 +348,15 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	spinlock_acquire(&cv->cv_wchanlock);
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
+	synch_preempt();
+}
+
+void
+cv_signal_handoff(struct cv *cv, struct lock *lock)
+{
+	(void)lock;
+	spinlock_acquire(&cv->cv_wchanlock);
+	wchan_wakeone_handoff(cv->cv_wchan, &cv->cv_wchanlock);
+	spinlock_release(&cv->cv_wchanlock);
+	synch_preempt();
 }
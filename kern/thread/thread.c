@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
+#include <clock.h>
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
@@ -50,6 +51,9 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmemcache.h>
+#include <klog.h>
+#include <platform/maxcpus.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -73,9 +77,20 @@ DEFARRAY(wchan, /*no inline*/ );
 static struct spinlock allwchans_lock;
 static struct wchanarray allwchans;
 
+/* Where thread structures come from. */
+static struct kmem_cache *thread_cache;
+
+/* Array of all threads (for accounting and debugging purposes) */
+static struct spinlock allthreads_lock;
+static struct threadarray allthreads;
+
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Used to wait for other CPUs to finish TLB shootdowns. */
+static struct wchan *shootdown_wchan;
+static struct spinlock shootdown_lock;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -115,6 +130,20 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor for thread_cache. The list node always points back at
+ * its thread and is off all lists whenever the thread is free, so it
+ * only needs setting up once.
+ */
+static
+void
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -124,17 +153,18 @@ struct thread *
 thread_create(const char *name)
 {
 	struct thread *thread;
+	int result;
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -142,19 +172,42 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
+	/* t_listnode is set up by thread_ctor */
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_class = TC_NORMAL;
+	thread->t_rtprio = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Accounting fields */
+	thread->t_stamp = gettime_ns();
+	thread->t_runtime = 0;
+	thread->t_waittime = 0;
+	thread->t_sleeptime = 0;
+	thread->t_nvcsw = 0;
+	thread->t_nivcsw = 0;
+	thread->t_migrations = 0;
+	thread->t_latkind = SCHEDLAT_REQUEUE;
+
 	/* If you add to struct thread, be sure to initialize here */
 
+	/* add to allthreads[] */
+	spinlock_acquire(&allthreads_lock);
+	result = threadarray_add(&allthreads, thread, &thread->t_index);
+	spinlock_release(&allthreads_lock);
+	if (result) {
+		KASSERT(result == ENOMEM);
+		kfree(thread->t_name);
+		kmem_cache_free(thread_cache, thread);
+		return NULL;
+	}
+
 	return thread;
 }
 
@@ -184,19 +237,32 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_switches = 0;
+	c->c_idletime = 0;
+	bzero(c->c_schedlat, sizeof(c->c_schedlat));
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
+	threadlist_init(&c->c_rtrunqueue);
+	threadlist_init(&c->c_idlerunqueue);
+	c->c_resched = false;
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_rt_hardclocks = 0;
+	c->c_rt_throttled = false;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
+	c->c_tlbsd_requested = 0;
+	c->c_tlbsd_ipis = 0;
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	klog_cpucreate(c->c_number);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -243,9 +309,25 @@ static
 void
 thread_destroy(struct thread *thread)
 {
+	unsigned num;
+	struct thread *t2;
+
 	KASSERT(thread != curthread);
 	KASSERT(thread->t_state != S_RUN);
 
+	/* remove from allthreads[] */
+	spinlock_acquire(&allthreads_lock);
+	num = threadarray_num(&allthreads);
+	KASSERT(threadarray_get(&allthreads, thread->t_index) == thread);
+	if (thread->t_index < num - 1) {
+		/* move the last entry into our slot */
+		t2 = threadarray_get(&allthreads, num - 1);
+		threadarray_set(&allthreads, thread->t_index, t2);
+		t2->t_index = thread->t_index;
+	}
+	threadarray_setsize(&allthreads, num - 1);
+	spinlock_release(&allthreads_lock);
+
 	/*
 	 * If you add things to struct thread, be sure to clean them up
 	 * either here or in thread_exit(). (And not both...)
@@ -263,7 +345,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -310,6 +392,14 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
 	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	curcpu->c_rtrunqueue.tl_count = 0;
+	curcpu->c_rtrunqueue.tl_head.tln_next = &curcpu->c_rtrunqueue.tl_tail;
+	curcpu->c_rtrunqueue.tl_tail.tln_prev = &curcpu->c_rtrunqueue.tl_head;
+	curcpu->c_idlerunqueue.tl_count = 0;
+	curcpu->c_idlerunqueue.tl_head.tln_next =
+		&curcpu->c_idlerunqueue.tl_tail;
+	curcpu->c_idlerunqueue.tl_tail.tln_prev =
+		&curcpu->c_idlerunqueue.tl_head;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -355,6 +445,16 @@ thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread), 0,
+					 thread_ctor);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
+	/* cpu_create makes threads, so allthreads must come first */
+	spinlock_init(&allthreads_lock);
+	threadarray_init(&allthreads);
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -388,6 +488,15 @@ thread_bootstrap(void)
 	spinlock_init(&allwchans_lock);
 	wchanarray_init(&allwchans);
 
+	/* cpuset_t must be able to hold every cpu */
+	COMPILE_ASSERT(MAXCPUS <= CPUSET_MAX);
+
+	spinlock_init(&shootdown_lock);
+	shootdown_wchan = wchan_create("tlbshootdown");
+	if (shootdown_wchan == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/* Done */
 }
 
@@ -439,6 +548,165 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Charge the time since T last changed state to *TOTAL, and restart
+ * the interval. A stamp of 0 means the interval started before the
+ * clock was attached during boot; such intervals aren't charged.
+ */
+static
+void
+thread_charge(struct thread *t, uint64_t *total, uint64_t now)
+{
+	if (t->t_stamp != 0) {
+		*total += now - t->t_stamp;
+	}
+	t->t_stamp = now;
+}
+
+/*
+ * Charge a thread that has just been switched to for the time it
+ * spent on the run queue, and record that wait in this cpu's
+ * scheduling latency histogram. Called with the run queue locked.
+ */
+static
+void
+thread_account_switchin(struct thread *cur)
+{
+	uint64_t now, wait;
+	unsigned bucket;
+
+	now = gettime_ns();
+	if (now != 0 && cur->t_stamp != 0) {
+		wait = now - cur->t_stamp;
+		for (bucket = 0; bucket < SCHEDLAT_NBUCKETS - 1; bucket++) {
+			if ((wait >> (bucket + 1)) == 0) {
+				break;
+			}
+		}
+		curcpu->c_schedlat[cur->t_latkind][bucket]++;
+	}
+	thread_charge(cur, &cur->t_waittime, now);
+}
+
+/*
+ * Charge a thread being woken up for the time it spent asleep. This
+ * must be done before it goes on a run queue, after which it can be
+ * picked up and switched to at any moment.
+ */
+static
+void
+thread_account_wakeup(struct thread *target)
+{
+	if (target->t_state == S_SLEEP) {
+		thread_charge(target, &target->t_sleeptime, gettime_ns());
+		target->t_state = S_READY;
+		target->t_latkind = curthread->t_in_interrupt ?
+			SCHEDLAT_INTRWAKE : SCHEDLAT_WAKEUP;
+	}
+}
+
+/*
+ * Returns true if thread A should run before thread B on cpu C. If
+ * C's real-time class is throttled, normal threads go first, the
+ * same order thread_runqueue_next uses.
+ */
+static
+bool
+thread_outranks(struct cpu *c, struct thread *a, struct thread *b)
+{
+	if (c->c_rt_throttled &&
+	    a->t_class != TC_IDLE && b->t_class != TC_IDLE &&
+	    a->t_class != b->t_class) {
+		return a->t_class == TC_NORMAL;
+	}
+	if (a->t_class != b->t_class) {
+		return a->t_class > b->t_class;
+	}
+	return a->t_class == TC_RT && a->t_rtprio > b->t_rtprio;
+}
+
+/*
+ * Put a thread on the appropriate run queue of cpu C, which must be
+ * locked. The real-time run queue is kept sorted by priority, with
+ * threads of equal priority in FIFO order; the others are plain FIFO.
+ *
+ * If the thread outranks what C is running, ask C to reschedule. If
+ * C is some other cpu, poke it with an interrupt so it notices soon;
+ * for this cpu, thread_check_preempt is called at the next safe
+ * point.
+ */
+static
+void
+thread_runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct thread *t2;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	switch (t->t_class) {
+	    case TC_IDLE:
+		/* never preempts anything */
+		threadlist_addtail(&c->c_idlerunqueue, t);
+		return;
+	    case TC_NORMAL:
+		threadlist_addtail(&c->c_runqueue, t);
+		break;
+	    case TC_RT:
+		THREADLIST_FORALL_REV(t2, c->c_rtrunqueue) {
+			if (t2->t_rtprio >= t->t_rtprio) {
+				break;
+			}
+		}
+		if (t2 == NULL) {
+			threadlist_addhead(&c->c_rtrunqueue, t);
+		}
+		else {
+			threadlist_insertafter(&c->c_rtrunqueue, t2, t);
+		}
+		break;
+	}
+
+	if (!c->c_isidle && !c->c_resched && c->c_curthread != t &&
+	    thread_outranks(c, t, c->c_curthread)) {
+		c->c_resched = true;
+		if (c != curcpu->c_self) {
+			ipi_send(c, IPI_RESCHED);
+		}
+	}
+}
+
+/*
+ * Take the next thread to run off cpu C's run queues, which must be
+ * locked. Real-time threads go first, unless the real-time class is
+ * throttled, in which case they only get what normal threads leave.
+ * Idle-class threads get what's left after that.
+ */
+static
+struct thread *
+thread_runqueue_next(struct cpu *c)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (c->c_rt_throttled) {
+		t = threadlist_remhead(&c->c_runqueue);
+		if (t == NULL) {
+			t = threadlist_remhead(&c->c_rtrunqueue);
+		}
+	}
+	else {
+		t = threadlist_remhead(&c->c_rtrunqueue);
+		if (t == NULL) {
+			t = threadlist_remhead(&c->c_runqueue);
+		}
+	}
+	if (t == NULL) {
+		t = threadlist_remhead(&c->c_idlerunqueue);
+	}
+	return t;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -451,6 +719,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
+	thread_account_wakeup(target);
+
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
@@ -463,7 +733,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -477,21 +747,84 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Make a thread runnable and put it at the front of the current cpu's
+ * run queue, so it is the next thread this cpu runs. This is the
+ * directed-handoff path: a thread that wakes another one and is about
+ * to block itself passes the cpu straight to the wakee, instead of
+ * leaving the wakee to wait behind unrelated threads (possibly on
+ * some other cpu) while this cpu goes looking for work.
+ *
+ * The target may be pulled over from another cpu only if it has
+ * completely switched out there. If that cpu is still the target's
+ * curthread (it went idle on the target's stack; see thread_switch)
+ * migrating it would be fatal, so leave it where it is.
+ */
+static
+void
+thread_make_runnable_next(struct thread *target)
+{
+	struct cpu *oldcpu;
+	bool canmove;
+
+	/*
+	 * Interrupt handlers don't block, so there's nothing to hand
+	 * off. Real-time threads go in priority order regardless.
+	 */
+	if (curthread->t_in_interrupt || target->t_class != TC_NORMAL) {
+		thread_make_runnable(target, false);
+		return;
+	}
+
+	oldcpu = target->t_cpu;
+	if (oldcpu != curcpu->c_self) {
+		/*
+		 * Holding the other cpu's run queue lock means it is not
+		 * in the middle of switching away from the target. Don't
+		 * hold it while taking ours; run queue locks have no
+		 * order among themselves.
+		 */
+		spinlock_acquire(&oldcpu->c_runqueue_lock);
+		canmove = (oldcpu->c_curthread != target);
+		if (canmove) {
+			target->t_cpu = curcpu->c_self;
+			target->t_migrations++;
+		}
+		spinlock_release(&oldcpu->c_runqueue_lock);
+
+		if (!canmove) {
+			thread_make_runnable(target, false);
+			return;
+		}
+		DEBUG(DB_THREADS, "Handoff pulled thread %s: cpu %u -> %u",
+		      target->t_name, oldcpu->c_number, curcpu->c_number);
+	}
+
+	thread_account_wakeup(target);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	threadlist_addhead(&curcpu->c_runqueue, target);
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
  * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT. It is in
+ * scheduling class CLASS, with real-time priority RTPRIO if that's
+ * TC_RT.
  *
  * The new thread is created in the process P. If P is null, the
  * process is inherited from the caller. It will start on the same CPU
  * as the caller, unless the scheduler intervenes first.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_class(const char *name,
+		  struct proc *proc,
+		  threadclass_t class, unsigned rtprio,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -500,6 +833,8 @@ thread_fork(const char *name,
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
+	newthread->t_class = class;
+	newthread->t_rtprio = rtprio;
 
 	/* Allocate a stack */
 	newthread->t_stack = kmalloc(STACK_SIZE);
@@ -543,6 +878,40 @@ thread_fork(const char *name,
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_class(name, proc, TC_NORMAL, 0,
+				 entrypoint, data1, data2);
+}
+
+int
+thread_fork_rt(const char *name,
+	       struct proc *proc,
+	       unsigned rtprio,
+	       void (*entrypoint)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2)
+{
+	if (rtprio > THREAD_RTPRIO_MAX) {
+		return EINVAL;
+	}
+	return thread_fork_class(name, proc, TC_RT, rtprio,
+				 entrypoint, data1, data2);
+}
+
+int
+thread_fork_idle(const char *name,
+		 struct proc *proc,
+		 void (*entrypoint)(void *data1, unsigned long data2),
+		 void *data1, unsigned long data2)
+{
+	return thread_fork_class(name, proc, TC_IDLE, 0,
+				 entrypoint, data1, data2);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -558,6 +927,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	uint64_t idlestart;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -584,12 +954,29 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    threadlist_isempty(&curcpu->c_rtrunqueue)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/*
+	 * Charge the time just spent running, and count the switch.
+	 * This (and the state change) must happen before the thread
+	 * becomes visible on a run queue or wait channel, because it
+	 * may be woken or picked up by another cpu right away.
+	 */
+	thread_charge(cur, &cur->t_runtime, gettime_ns());
+	cur->t_latkind = SCHEDLAT_REQUEUE;
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_nivcsw++;
+	}
+	else if (newstate != S_ZOMBIE) {
+		cur->t_nvcsw++;
+	}
+	cur->t_state = newstate;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -615,7 +1002,6 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		threadlist_addtail(&curcpu->c_zombies, cur);
 		break;
 	}
-	cur->t_state = newstate;
 
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
@@ -636,11 +1022,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	curcpu->c_resched = false;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = thread_runqueue_next(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+			idlestart = gettime_ns();
 			cpu_idle();
+			if (idlestart != 0) {
+				curcpu->c_idletime += gettime_ns() - idlestart;
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -655,6 +1046,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 */
 	curcpu->c_curthread = next;
 	curthread = next;
+	if (next != cur) {
+		curcpu->c_switches++;
+	}
 
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
@@ -710,6 +1104,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Charge the time spent waiting on the run queue. */
+	thread_account_switchin(cur);
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -743,6 +1140,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Charge the time spent waiting on the run queue. */
+	thread_account_switchin(cur);
+
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -823,6 +1223,28 @@ schedule(void)
 	 */
 }
 
+/*
+ * Preemption check. If a thread that outranks the current one was
+ * made runnable on this cpu, yield to it, unless we're holding
+ * spinlocks or have interrupts turned off in thread context (both of
+ * which mean the caller is relying on not being switched out). From
+ * an interrupt handler this is the same preemption hardclock does.
+ */
+void
+thread_check_preempt(void)
+{
+	if (!curcpu->c_resched) {
+		return;
+	}
+	if (curcpu->c_spinlocks > 0) {
+		return;
+	}
+	if (!curthread->t_in_interrupt && curthread->t_curspl > 0) {
+		return;
+	}
+	thread_yield();
+}
+
 /*
  * Thread migration.
  *
@@ -912,6 +1334,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
+			t->t_migrations++;
 			threadlist_addtail(&c->c_runqueue, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
@@ -947,6 +1370,260 @@ thread_consider_migration(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Accounting.
+ */
+
+/* Snapshot of one thread's accounting, taken for thread_printstats. */
+struct threadsnap {
+	char ts_name[16];
+	char ts_wchan[16];
+	threadstate_t ts_state;
+	char ts_class[6];
+	int ts_cpu;
+	uint64_t ts_runtime;
+	uint64_t ts_waittime;
+	uint64_t ts_sleeptime;
+	unsigned ts_nvcsw;
+	unsigned ts_nivcsw;
+	unsigned ts_migrations;
+	struct proc *ts_proc;		/* only compared, never followed */
+	unsigned ts_tlbmisses;
+	unsigned ts_tlbevictions;
+	unsigned ts_tlbpreloads;
+};
+
+/*
+ * Print accounting information for all threads and cpus. Like ps -l
+ * in Unix.
+ *
+ * The thread information is copied out while holding allthreads_lock
+ * and printed afterwards, so that printing (which is slow and may
+ * sleep) happens without the lock. The numbers for threads running on
+ * other cpus are read without synchronization and may be slightly
+ * stale, which is fine for this purpose. Process fields are copied
+ * under the process's p_lock (taken after allthreads_lock).
+ */
+void
+thread_printstats(void)
+{
+	struct threadsnap *snaps, *ts;
+	struct thread *t;
+	struct proc *proc;
+	struct cpu *c;
+	unsigned i, j, num, max;
+	uint64_t now;
+	const char *state;
+
+	/* allow a few extra slots for threads forked in the meantime */
+	spinlock_acquire(&allthreads_lock);
+	max = threadarray_num(&allthreads) + 8;
+	spinlock_release(&allthreads_lock);
+
+	snaps = kmalloc(max * sizeof(*snaps));
+	if (snaps == NULL) {
+		kprintf("thread_printstats: Out of memory\n");
+		return;
+	}
+
+	spinlock_acquire(&allthreads_lock);
+	now = gettime_ns();
+	num = threadarray_num(&allthreads);
+	if (num > max) {
+		num = max;
+	}
+	for (i=0; i<num; i++) {
+		t = threadarray_get(&allthreads, i);
+		ts = &snaps[i];
+		snprintf(ts->ts_name, sizeof(ts->ts_name), "%s", t->t_name);
+		snprintf(ts->ts_wchan, sizeof(ts->ts_wchan), "%s",
+			 t->t_wchan_name != NULL ? t->t_wchan_name : "-");
+		ts->ts_state = t->t_state;
+		if (t->t_class == TC_RT) {
+			snprintf(ts->ts_class, sizeof(ts->ts_class), "rt%u",
+				 t->t_rtprio);
+		}
+		else if (t->t_class == TC_IDLE) {
+			strcpy(ts->ts_class, "idle");
+		}
+		else {
+			strcpy(ts->ts_class, "-");
+		}
+		ts->ts_cpu = t->t_cpu != NULL ? (int)t->t_cpu->c_number : -1;
+		ts->ts_runtime = t->t_runtime;
+		ts->ts_waittime = t->t_waittime;
+		ts->ts_sleeptime = t->t_sleeptime;
+		/* charge the current interval to whatever it's doing now */
+		if (t->t_stamp != 0 && t->t_state == S_RUN) {
+			ts->ts_runtime += now - t->t_stamp;
+		}
+		else if (t->t_stamp != 0 && t->t_state == S_READY) {
+			ts->ts_waittime += now - t->t_stamp;
+		}
+		else if (t->t_stamp != 0 && t->t_state == S_SLEEP) {
+			ts->ts_sleeptime += now - t->t_stamp;
+		}
+		ts->ts_nvcsw = t->t_nvcsw;
+		ts->ts_nivcsw = t->t_nivcsw;
+		ts->ts_migrations = t->t_migrations;
+		/* t_proc can go to NULL under us; read it once. */
+		proc = t->t_proc;
+		ts->ts_proc = proc;
+		if (proc != NULL) {
+			spinlock_acquire(&proc->p_lock);
+			ts->ts_tlbmisses = proc->p_tlbmisses;
+			ts->ts_tlbevictions = proc->p_tlbevictions;
+			ts->ts_tlbpreloads = proc->p_tlbpreloads;
+			spinlock_release(&proc->p_lock);
+		}
+	}
+	spinlock_release(&allthreads_lock);
+
+	kprintf("%-15s %-5s %-4s %3s %10s %10s %10s %7s %7s %5s %s\n",
+		"NAME", "STATE", "PRI", "CPU", "RUN(us)", "WAIT(us)", "SLEEP(us)",
+		"VCSW", "IVCSW", "MIGR", "WCHAN");
+	for (i=0; i<num; i++) {
+		ts = &snaps[i];
+		switch (ts->ts_state) {
+		    case S_RUN: state = "run"; break;
+		    case S_READY: state = "ready"; break;
+		    case S_SLEEP: state = "sleep"; break;
+		    case S_ZOMBIE: state = "zomb"; break;
+		    default: state = "?"; break;
+		}
+		kprintf("%-15s %-5s %-4s %3d %10llu %10llu %10llu %7u %7u %5u "
+			"%s\n",
+			ts->ts_name, state, ts->ts_class, ts->ts_cpu,
+			(unsigned long long)(ts->ts_runtime / 1000),
+			(unsigned long long)(ts->ts_waittime / 1000),
+			(unsigned long long)(ts->ts_sleeptime / 1000),
+			ts->ts_nvcsw, ts->ts_nivcsw, ts->ts_migrations,
+			ts->ts_wchan);
+	}
+
+	/* TLB pressure, once per user process. */
+	kprintf("\n%-15s %10s %10s %10s\n", "PROCESS", "TLBMISS", "TLBEVICT",
+		"PRELOAD");
+	for (i=0; i<num; i++) {
+		ts = &snaps[i];
+		if (ts->ts_proc == NULL || ts->ts_proc == kproc) {
+			continue;
+		}
+		for (j=0; j<i; j++) {
+			if (snaps[j].ts_proc == ts->ts_proc) {
+				break;
+			}
+		}
+		if (j < i) {
+			continue;
+		}
+		kprintf("%-15s %10u %10u %10u\n", ts->ts_name,
+			ts->ts_tlbmisses, ts->ts_tlbevictions,
+			ts->ts_tlbpreloads);
+	}
+	kfree(snaps);
+
+	kprintf("\n%-5s %10s %10s %10s %8s %8s %s\n",
+		"CPU", "SWITCHES", "HARDCLOCKS", "IDLE(us)", "TLBSD", "SD-IPIS",
+		"RT");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%-2u %10u %10u %10llu %8u %8u %s\n", c->c_number,
+			c->c_switches, c->c_hardclocks,
+			(unsigned long long)(c->c_idletime / 1000),
+			c->c_tlbsd_requested, c->c_tlbsd_ipis,
+			c->c_rt_throttled ? "throttled" : "ok");
+	}
+}
+
+/*
+ * Print the scheduling latency histograms: one row per bucket that
+ * has anything in it, with the count for each kind of wait, summed
+ * over all cpus and then for each cpu separately.
+ *
+ * The counters are updated by each cpu without locking, so a
+ * histogram read while the system is busy is only approximately
+ * consistent.
+ */
+static
+void
+schedlat_print(const char *title, unsigned hist[][SCHEDLAT_NBUCKETS])
+{
+	unsigned b, k, total;
+	uint64_t lo;
+
+	total = 0;
+	for (k=0; k<SCHEDLAT_NKINDS; k++) {
+		for (b=0; b<SCHEDLAT_NBUCKETS; b++) {
+			total += hist[k][b];
+		}
+	}
+	kprintf("%s: %u switches\n", title, total);
+	if (total == 0) {
+		return;
+	}
+
+	kprintf("    %12s %10s %10s %10s\n",
+		">= ns", "requeue", "wakeup", "intrwake");
+	for (b=0; b<SCHEDLAT_NBUCKETS; b++) {
+		if (hist[SCHEDLAT_REQUEUE][b] == 0 &&
+		    hist[SCHEDLAT_WAKEUP][b] == 0 &&
+		    hist[SCHEDLAT_INTRWAKE][b] == 0) {
+			continue;
+		}
+		lo = b == 0 ? 0 : (uint64_t)1 << b;
+		kprintf("    %12llu %10u %10u %10u\n",
+			(unsigned long long)lo,
+			hist[SCHEDLAT_REQUEUE][b],
+			hist[SCHEDLAT_WAKEUP][b],
+			hist[SCHEDLAT_INTRWAKE][b]);
+	}
+}
+
+void
+thread_printschedlat(void)
+{
+	unsigned sum[SCHEDLAT_NKINDS][SCHEDLAT_NBUCKETS];
+	char title[16];
+	unsigned i, k, b;
+	struct cpu *c;
+
+	bzero(sum, sizeof(sum));
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		for (k=0; k<SCHEDLAT_NKINDS; k++) {
+			for (b=0; b<SCHEDLAT_NBUCKETS; b++) {
+				sum[k][b] += c->c_schedlat[k][b];
+			}
+		}
+	}
+	schedlat_print("all cpus", sum);
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		snprintf(title, sizeof(title), "cpu%u", c->c_number);
+		schedlat_print(title, c->c_schedlat);
+	}
+}
+
+/*
+ * Clear the histograms. Again no locking; a few events recorded while
+ * this runs may survive it.
+ */
+void
+thread_resetschedlat(void)
+{
+	unsigned i;
+	struct cpu *c;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		bzero(c->c_schedlat, sizeof(c->c_schedlat));
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Wait channel functions
  */
@@ -1065,6 +1742,27 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	thread_make_runnable(target, false);
 }
 
+/*
+ * Wake up one thread sleeping on a wait channel and queue it to run
+ * next on this cpu. For callers that are about to block right away;
+ * see thread_make_runnable_next.
+ */
+void
+wchan_wakeone_handoff(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	target = threadlist_remhead(&wc->wc_threads);
+	if (target == NULL) {
+		return;
+	}
+
+	/* Lock ordering is as in wchan_wakeone. */
+	thread_make_runnable_next(target);
+}
+
 /*
  * Wake up all threads sleeping on a wait channel.
  */
@@ -1147,32 +1845,138 @@ ipi_broadcast(int code)
 	}
 }
 
-void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+/*
+ * Queue NUM TLB shootdowns for TARGET, which must be locked. Returns
+ * the shootdown sequence number the work was posted under.
+ *
+ * If TARGET still has a shootdown IPI pending that it hasn't taken
+ * yet, the new work is merged into it and no new IPI is sent; the
+ * target processes everything queued when it does take the interrupt.
+ */
+static
+unsigned
+ipi_post_tlbshootdown(struct cpu *target,
+		      const struct tlbshootdown *mappings, unsigned num)
 {
+	unsigned i;
 	int n;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n == TLBSHOOTDOWN_ALL) {
+		/* Already flushing everything. */
+	}
+	else if (n + num > TLBSHOOTDOWN_MAX) {
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+		for (i=0; i<num; i++) {
+			target->c_shootdown[n + i] = mappings[i];
+		}
+		target->c_numshootdown = n + num;
 	}
+	target->c_shootdown_seq++;
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	if ((target->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN)) == 0) {
+		target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+		mainbus_send_ipi(target);
+		curcpu->c_tlbsd_ipis++;
+	}
+	curcpu->c_tlbsd_requested += num;
 
+	return target->c_shootdown_seq;
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_post_tlbshootdown(target, mapping, 1);
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_batch(cpuset_t targets,
+		       const struct tlbshootdown *mappings, unsigned num)
+{
+	unsigned seqs[CPUSET_MAX];
+	cpuset_t posted;
+	unsigned i, j, numcpus;
+	struct cpu *c;
+	int spl;
+
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	if (num == 0) {
+		return;
+	}
+
+	/*
+	 * Stay on this cpu until the work has been posted and our own
+	 * part of it done, so "this cpu" means the same thing all the
+	 * way through.
+	 */
+	spl = splhigh();
+
+	posted = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((targets & CPUSET_BIT(c->c_number)) == 0 ||
+		    c == curcpu->c_self) {
+			continue;
+		}
+		spinlock_acquire(&c->c_ipi_lock);
+		seqs[i] = ipi_post_tlbshootdown(c, mappings, num);
+		spinlock_release(&c->c_ipi_lock);
+		posted |= CPUSET_BIT(c->c_number);
+	}
+
+	/* Do the local part directly while the others are working. */
+	if (targets & CPUSET_BIT(curcpu->c_number)) {
+		curcpu->c_tlbsd_requested += num;
+		if (num > TLBSHOOTDOWN_MAX) {
+			vm_tlbshootdown_all();
+		}
+		else {
+			for (j=0; j<num; j++) {
+				vm_tlbshootdown(&mappings[j]);
+			}
+		}
+	}
+
+	splx(spl);
+
+	if (posted == 0) {
+		return;
+	}
+
+	/*
+	 * Wait for the acknowledgements. The targets update
+	 * c_shootdown_done before taking shootdown_lock to wake us, so
+	 * checking it under the lock can't miss a wakeup. (The sequence
+	 * numbers may wrap; compare by difference.)
+	 */
+	spinlock_acquire(&shootdown_lock);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((posted & CPUSET_BIT(c->c_number)) == 0) {
+			continue;
+		}
+		while ((int)(c->c_shootdown_done - seqs[i]) < 0) {
+			wchan_sleep(shootdown_wchan, &shootdown_lock);
+		}
+	}
+	spinlock_release(&shootdown_lock);
+}
+
 void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
+	bool shotdown = false;
 	int i;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
@@ -1201,6 +2005,12 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	if (bits & (1U << IPI_RESCHED)) {
+		/*
+		 * c_resched is already set; the preemption happens on
+		 * the way out of the interrupt (see mips_trap).
+		 */
+	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
 			vm_tlbshootdown_all();
@@ -1211,8 +2021,17 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
+		shotdown = true;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (shotdown) {
+		/* Let anyone waiting in ipi_tlbshootdown_batch recheck. */
+		spinlock_acquire(&shootdown_lock);
+		wchan_wakeall(shootdown_wchan, &shootdown_lock);
+		spinlock_release(&shootdown_lock);
+	}
 }
@@ -241,15 +241,41 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Only block devices make sense to map; they are treated
+ * like a file whose size is the size of the device.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, struct uio *uio)
 {
-	(void)v;
-	return ENOSYS;
+	struct device *d = v->vn_data;
+	off_t size, endpos;
+	size_t extraresid;
+	int result;
+
+	if (d->d_blocks == 0) {
+		return ENODEV;
+	}
+
+	size = (off_t)d->d_blocks * d->d_blocksize;
+	endpos = uio->uio_offset + uio->uio_resid;
+	if (uio->uio_offset >= size) {
+		extraresid = uio->uio_resid;
+	}
+	else if (endpos > size) {
+		extraresid = endpos - size;
+	}
+	else {
+		extraresid = 0;
+	}
+
+	uio->uio_resid -= extraresid;
+	result = uio->uio_resid > 0 ? DEVOP_IO(d, uio) : 0;
+	if (result == 0 && uio->uio_rw == UIO_READ && extraresid > 0) {
+		uio->uio_resid += extraresid;
+		result = uiomovezeros(extraresid, uio);
+	}
+	return result;
 }
 
 /*
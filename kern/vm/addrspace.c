@@ -29,60 +29,283 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <spl.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
 #include <addrspace.h>
+#include <pagetable.h>
 #include <vm.h>
+#include <swap.h>
+#include <mmfile.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * An address space is a list of regions plus a page table. Defining
+ * a region allocates no memory; vm_fault allocates and zero-fills
+ * each page the first time it is touched, and records it in the page
+ * table. So the memory a process uses is the memory it has touched,
+ * not the size of its executable. Regions made by mmap of a file get
+ * their pages from the file's page cache instead (see mmfile.h).
  */
 
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
+	unsigned i;
 
 	as = kmalloc(sizeof(struct addrspace));
 	if (as == NULL) {
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_cpus = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+	as->as_stack = NULL;
+	as->as_loading = false;
 
 	return as;
 }
 
+/*
+ * Copy the region list of OLD into NEWAS.
+ */
+static
+int
+as_copyregions(struct addrspace *old, struct addrspace *newas)
+{
+	struct region *rg, *newrg, **tailp;
+
+	tailp = &newas->as_regions;
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		newrg = kmalloc(sizeof(*newrg));
+		if (newrg == NULL) {
+			return ENOMEM;
+		}
+		*newrg = *rg;
+		newrg->rg_next = NULL;
+		if (newrg->rg_file != NULL) {
+			mmfile_incref(newrg->rg_file);
+		}
+		if (rg == old->as_heap) {
+			newas->as_heap = newrg;
+		}
+		if (rg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+		*tailp = newrg;
+		tailp = &newrg->rg_next;
+	}
+	newas->as_heapend = old->as_heapend;
+	return 0;
+}
+
+/*
+ * Share the resident pages of OLD with NEWAS. Nothing is copied:
+ * pages that may be written become copy-on-write in both, and the first
+ * write fault on each side gets its own copy (see vm_fault), except
+ * for pages of shared file mappings, which stay shared. Pages
+ * OLD has never touched stay untouched in NEWAS too, and will be
+ * zero-filled there on demand just as they would have been in OLD.
+ * Pages OLD has paged out are brought back in first, and shared pages
+ * lose their swap copies, since only unshared pages are paged.
+ *
+ * Returns true in *WRPROTECTED if any of OLD's pages lost write
+ * permission, so the caller knows to flush OLD's TLB entries.
+ */
+static
+int
+as_sharepages(struct addrspace *old, struct addrspace *newas,
+	      bool *wrprotected)
+{
+	unsigned d, p, slot;
+	pte_t *oldptes, *newpte;
+	int result;
+
+	for (d=0; d<PT_NDIR; d++) {
+		oldptes = old->as_pt->pt_dir[d];
+		if (oldptes == NULL) {
+			continue;
+		}
+		for (p=0; p<PT_NPTE; p++) {
+			if ((oldptes[p] & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+			/*
+			 * Allocating can page out OLD's unshared pages,
+			 * so get the new PTE before looking at this one.
+			 */
+			newpte = pt_lookup(newas->as_pt, PT_VADDR(d, p), true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+			if (oldptes[p] & PTE_SWAPPED) {
+				result = vm_pagein(old, PT_VADDR(d, p),
+						   &oldptes[p]);
+				if (result) {
+					return result;
+				}
+			}
+			if ((oldptes[p] & (PTE_WRITE | PTE_SHARED)) ==
+			    PTE_WRITE) {
+				oldptes[p] &= ~(pte_t)PTE_WRITE;
+				oldptes[p] |= PTE_COW;
+				*wrprotected = true;
+			}
+			slot = coremap_takeslot(oldptes[p] & PTE_FRAME);
+			if (slot != SWAP_NOSLOT) {
+				swap_free(slot);
+				oldptes[p] |= PTE_DIRTY;
+			}
+			coremap_share(oldptes[p] & PTE_FRAME);
+			*newpte = oldptes[p];
+		}
+	}
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	bool wrprotected = false;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	lock_acquire(old->as_lock);
+	result = as_copyregions(old, newas);
+	if (!result) {
+		result = as_sharepages(old, newas, &wrprotected);
+	}
 	/*
-	 * Write this.
+	 * Even on failure some pages may have become copy-on-write;
+	 * that's harmless, but their writeable TLB entries must go
+	 * either way.
 	 */
+	if (wrprotected) {
+		vm_tlbflush_as(old);
+	}
+	lock_release(old->as_lock);
 
-	(void)old;
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
 }
 
+/*
+ * Free the page (or swap slot) a PTE refers to, and clear the PTE.
+ */
+static
+void
+as_freepage(pte_t *pte)
+{
+	unsigned slot;
+
+	if (*pte & PTE_VALID) {
+		slot = coremap_takeslot(*pte & PTE_FRAME);
+		if (slot != SWAP_NOSLOT) {
+			swap_free(slot);
+		}
+		coremap_free(*pte & PTE_FRAME);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SWAPSLOT(*pte));
+	}
+	*pte = 0;
+}
+
+/*
+ * Free the pages of a region, first telling its file which of them
+ * were written through a shared mapping. Doesn't touch the TLB.
+ */
+static
+void
+as_freeregion(struct addrspace *as, struct region *rg)
+{
+	pte_t *pte;
+	size_t i;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (i=0; i<rg->rg_npages; i++) {
+		pte = pt_lookup(as->as_pt, rg->rg_base + i * PAGE_SIZE, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if ((*pte & (PTE_VALID | PTE_SHARED | PTE_DIRTY)) ==
+		    (PTE_VALID | PTE_SHARED | PTE_DIRTY)) {
+			mmfile_setdirty(rg->rg_file, rg->rg_filepage + i);
+		}
+		as_freepage(pte);
+	}
+}
+
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
+	unsigned d, p;
+	pte_t *ptes;
+
+	/* Wait out vm_pageout if it's working on our pages. */
+	lock_acquire(as->as_lock);
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_file != NULL) {
+			as_freeregion(as, rg);
+		}
+	}
+	for (d=0; d<PT_NDIR; d++) {
+		ptes = as->as_pt->pt_dir[d];
+		if (ptes == NULL) {
+			continue;
+		}
+		for (p=0; p<PT_NPTE; p++) {
+			as_freepage(&ptes[p]);
+		}
+	}
+	lock_release(as->as_lock);
+	pt_destroy(as->as_pt);
 
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_file != NULL) {
+			mmfile_release(rg->rg_file);
+		}
+		kfree(rg);
+	}
+
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -90,8 +313,9 @@ void
 as_activate(void)
 {
 	struct addrspace *as;
+	int spl;
 
-	as = curproc_getas();
+	as = proc_getas();
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
@@ -101,77 +325,205 @@ as_activate(void)
 	}
 
 	/*
-	 * Write this.
+	 * Translations are tagged with an address space ID, so other
+	 * address spaces' entries can stay in the TLB; just switch
+	 * which ID is current.
 	 */
+	spl = splhigh();
+	as->as_cpus |= CPUSET_BIT(curcpu->c_number);
+	vm_tlbactivate(as);
+	splx(spl);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do: the next as_activate switches address space
+	 * IDs, and a dead address space's ID is never current again.
 	 */
 }
 
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_base &&
+		    vaddr < rg->rg_base + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Add a region of NPAGES pages at VADDR (page-aligned) with RG_*
+ * flags FLAGS, unless it overlaps one already there. NPAGES may be 0
+ * for a region that will grow (the heap). The address space must be
+ * locked.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vaddr, size_t npages, int flags,
+	     struct region **ret)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	if (vaddr >= USERSPACETOP ||
+	    npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr < rg->rg_base + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_base < vaddr + npages * PAGE_SIZE) {
+			return EINVAL;
+		}
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_flags = flags;
+	rg->rg_file = NULL;
+	rg->rg_filepage = 0;
+	rg->rg_ranext = 0;
+	rg->rg_rastart = rg->rg_raend = 0;
+	rg->rg_rawindow = VM_RAINITIAL;
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+
+	*ret = rg;
+	return 0;
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. The
+ * MIPS TLB can only express writeable or not, so that is the only
+ * one enforced.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	size_t npages;
+	int result;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
 
-	(void)as;
-	(void)vaddr;
-	(void)sz;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return EUNIMP;
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+	if (npages == 0) {
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+	result = as_addregion(as, vaddr, npages,
+			      (readable ? RG_READ : 0) |
+			      (writeable ? RG_WRITE : 0) |
+			      (executable ? RG_EXEC : 0), &rg);
+	lock_release(as->as_lock);
+	return result;
 }
 
+/*
+ * While loading, every region is writeable so load_elf can fill in
+ * the text segment. Nothing is allocated here; the loader's writes
+ * fault the pages in.
+ */
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
-	(void)as;
+	lock_acquire(as->as_lock);
+	as->as_loading = true;
+	lock_release(as->as_lock);
 	return 0;
 }
 
+/*
+ * Loading is over. Pages of read-only regions were made writeable so
+ * the loader could fill them in; take that back, and drop the TLB
+ * entries made while loading, on whatever cpus they were made.
+ *
+ * Then put the heap, empty for now, right after the highest region.
+ */
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t va, top;
+	pte_t *pte;
+	size_t i;
+	int result;
 
-	(void)as;
-	return 0;
+	lock_acquire(as->as_lock);
+	as->as_loading = false;
+	top = 0;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_base + rg->rg_npages * PAGE_SIZE > top) {
+			top = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		}
+		if (rg->rg_flags & RG_WRITE) {
+			continue;
+		}
+		for (i=0; i<rg->rg_npages; i++) {
+			va = rg->rg_base + i * PAGE_SIZE;
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL) {
+				*pte &= ~(pte_t)PTE_WRITE;
+			}
+		}
+	}
+
+	KASSERT(as->as_heap == NULL);
+	result = as_addregion(as, top, 0, RG_READ | RG_WRITE, &as->as_heap);
+	if (result) {
+		as->as_heap = NULL;
+	}
+	else {
+		as->as_heapend = top;
+	}
+	lock_release(as->as_lock);
+
+	vm_tlbflush_as(as);
+	return result;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	lock_acquire(as->as_lock);
+	KASSERT(as->as_stack == NULL);
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES, RG_READ | RG_WRITE, &as->as_stack);
+	if (result) {
+		as->as_stack = NULL;
+	}
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -179,3 +531,304 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Top of the space mmap and the heap may use: the stack keeps
+ * VM_STACKMAX + VM_STACKGUARD pages below USERSTACK for itself, its
+ * largest size plus the guard gap.
+ */
+#define STACKFLOOR	(USERSTACK - (VM_STACKMAX + VM_STACKGUARD) * PAGE_SIZE)
+
+/*
+ * Check that NPAGES pages at VADDR end at or below STACKFLOOR, which
+ * keeps mmap out of the stack's reserve.
+ */
+static
+bool
+as_belowstack(vaddr_t vaddr, size_t npages)
+{
+	return vaddr <= STACKFLOOR &&
+		npages <= (STACKFLOOR - vaddr) / PAGE_SIZE;
+}
+
+/*
+ * Find NPAGES free pages of address space for mmap, from VM_MMAPBASE
+ * up to where the stack might grow. The address space must be locked.
+ */
+static
+int
+as_findspace(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t vaddr;
+
+	vaddr = VM_MMAPBASE;
+ again:
+	if (!as_belowstack(vaddr, npages)) {
+		return ENOMEM;
+	}
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr < rg->rg_base + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_base < vaddr + npages * PAGE_SIZE) {
+			vaddr = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+			goto again;
+		}
+	}
+	*ret = vaddr;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int prot, int flags,
+	struct vnode *vn, off_t offset)
+{
+	struct mmfile *mf;
+	struct region *rg;
+	vaddr_t vaddr;
+	size_t npages;
+	int rgflags, result;
+
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		rgflags = RG_SHARED;
+		break;
+	    case MAP_PRIVATE:
+		rgflags = 0;
+		break;
+	    default:
+		return EINVAL;
+	}
+	if ((vn == NULL) != ((flags & MAP_ANON) != 0)) {
+		return EINVAL;
+	}
+	if (vn == NULL && (flags & MAP_SHARED)) {
+		/* Anonymous memory is only ever private. */
+		return EINVAL;
+	}
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	/* Keeps page numbers in the file well within an unsigned. */
+	if (offset / PAGE_SIZE > USERSPACETOP / PAGE_SIZE) {
+		return EINVAL;
+	}
+	if ((flags & MAP_FIXED) && *addr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+
+	rgflags |= ((prot & PROT_READ) ? RG_READ : 0) |
+		((prot & PROT_WRITE) ? RG_WRITE : 0) |
+		((prot & PROT_EXEC) ? RG_EXEC : 0);
+
+	mf = NULL;
+	if (vn != NULL) {
+		result = mmfile_get(vn, &mf);
+		if (result) {
+			return result;
+		}
+	}
+
+	lock_acquire(as->as_lock);
+	if (flags & MAP_FIXED) {
+		vaddr = *addr;
+		result = as_belowstack(vaddr, npages) ? 0 : ENOMEM;
+	}
+	else {
+		result = as_findspace(as, npages, &vaddr);
+	}
+	if (!result) {
+		result = as_addregion(as, vaddr, npages, rgflags, &rg);
+	}
+	if (result) {
+		lock_release(as->as_lock);
+		if (mf != NULL) {
+			mmfile_release(mf);
+		}
+		return result;
+	}
+	rg->rg_file = mf;
+	rg->rg_filepage = offset / PAGE_SIZE;
+	lock_release(as->as_lock);
+
+	*addr = vaddr;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *rg, **rgp, *gone;
+	vaddr_t end;
+
+	if (addr % PAGE_SIZE != 0 || len == 0 || addr >= USERSPACETOP ||
+	    len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	end = addr + len;
+
+	lock_acquire(as->as_lock);
+
+	/*
+	 * Check first, so that nothing changes on failure. The heap and
+	 * stack can't be unmapped; sbrk is how the heap gets smaller.
+	 */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_base >= addr && rg->rg_base < end &&
+		    (rg == as->as_heap || rg == as->as_stack)) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		if (addr < rg->rg_base + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_base < end &&
+		    (rg->rg_base < addr ||
+		     rg->rg_base + rg->rg_npages * PAGE_SIZE > end)) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+	}
+
+	gone = NULL;
+	rgp = &as->as_regions;
+	while (*rgp != NULL) {
+		rg = *rgp;
+		if (rg->rg_base >= addr && rg->rg_base < end) {
+			*rgp = rg->rg_next;
+			rg->rg_next = gone;
+			gone = rg;
+		}
+		else {
+			rgp = &rg->rg_next;
+		}
+	}
+
+	/* The TLB entries must go before the pages can be reused. */
+	if (gone != NULL) {
+		vm_tlbflush_as(as);
+	}
+	while (gone != NULL) {
+		rg = gone;
+		gone = rg->rg_next;
+		as_freeregion(as, rg);
+		if (rg->rg_file != NULL) {
+			mmfile_release(rg->rg_file);
+		}
+		kfree(rg);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+/*
+ * Check that the range from START to END, which is about to become
+ * part of region SELF, overlaps no other region and comes no closer
+ * than VM_STACKGUARD pages to the stack (or, if SELF is the stack, to
+ * anything else). The address space must be locked.
+ */
+static
+bool
+as_guardok(struct addrspace *as, struct region *self,
+	   vaddr_t start, vaddr_t end)
+{
+	struct region *rg;
+	vaddr_t rgstart, rgend, gap;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg == self) {
+			continue;
+		}
+		gap = 0;
+		if (rg == as->as_stack || self == as->as_stack) {
+			gap = VM_STACKGUARD * PAGE_SIZE;
+		}
+		rgstart = rg->rg_base;
+		rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (rgend + gap > start && rgstart < end + gap) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap;
+	vaddr_t oldend, newend, va;
+	size_t newpages, i;
+	pte_t *pte;
+
+	lock_acquire(as->as_lock);
+	heap = as->as_heap;
+	if (heap == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+	oldend = as->as_heapend;
+
+	if (amount < 0 && (size_t)-amount > oldend - heap->rg_base) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	if (amount > 0 && (size_t)amount > STACKFLOOR - oldend) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+	newend = oldend + amount;
+	newpages = (newend - heap->rg_base + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	if (newpages > heap->rg_npages) {
+		/*
+		 * Growing. The stack keeps its guard gap from the heap
+		 * just as the heap does from the stack, so check against
+		 * every other region.
+		 */
+		if (!as_guardok(as, heap,
+				heap->rg_base + heap->rg_npages * PAGE_SIZE,
+				heap->rg_base + newpages * PAGE_SIZE)) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+	else if (newpages < heap->rg_npages) {
+		/* Shrinking: the TLB entries go before the pages do. */
+		vm_tlbflush_as(as);
+		for (i=newpages; i<heap->rg_npages; i++) {
+			va = heap->rg_base + i * PAGE_SIZE;
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL) {
+				as_freepage(pte);
+			}
+		}
+	}
+	heap->rg_npages = newpages;
+	as->as_heapend = newend;
+	lock_release(as->as_lock);
+
+	*oldbreak = oldend;
+	return 0;
+}
+
+struct region *
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack;
+	vaddr_t newbase;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	stack = as->as_stack;
+	if (stack == NULL || vaddr >= stack->rg_base || vaddr < STACKFLOOR) {
+		return NULL;
+	}
+	newbase = vaddr & PAGE_FRAME;
+	if (!as_guardok(as, stack, newbase, stack->rg_base)) {
+		return NULL;
+	}
+	stack->rg_npages += (stack->rg_base - newbase) / PAGE_SIZE;
+	stack->rg_base = newbase;
+	return stack;
+}
@@ -0,0 +1,776 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Physical page allocator (coremap).
+ *
+ * At boot we take all the physical memory ram_getsize reports and
+ * keep one struct coremap_entry for each page of it. Free memory is
+ * managed with a binary buddy scheme: free blocks of 2^k pages,
+ * aligned to 2^k pages (relative to the first managed page), are kept
+ * on one free list per order k. The lists are doubly linked through
+ * the coremap entries, so a block can be taken off its list in
+ * constant time when its buddy is freed.
+ *
+ * Allocating n pages takes a block of the smallest order that fits,
+ * splitting larger blocks as needed, and then gives back the unused
+ * tail so that runs that aren't a power of two don't waste memory.
+ * Freeing a run breaks it into aligned power-of-two pieces and frees
+ * each, merging with free buddies as far as possible. Both are
+ * bounded by the number of orders, and a single page comes straight
+ * off the order-0 list when there is one.
+ *
+ * Every page has a state. The first page of an allocated run records
+ * the run's length, which is how coremap_free knows how much to free.
+ * A single page can be shared (for copy-on-write); it then also counts
+ * its extra references, and coremap_free only drops one of those
+ * until the last user lets go.
+ *
+ * Memory grabbed with ram_stealmem before coremap_bootstrap is not
+ * managed here and can't be freed; coremap_free ignores it.
+ *
+ * User pages: a single page mapped by exactly one address space can
+ * be given an owner (address space and virtual address). Owned pages
+ * are what the pageout clock (coremap_victim) picks from; the caller
+ * does the rest. A page being paged out is marked busy so it isn't
+ * picked twice. A clean user page can also carry the swap slot that
+ * holds a copy of it.
+ *
+ * Zeroed pages: a pool of single pages that have already been zeroed
+ * is kept off to the side, so coremap_alloc_zeroed(1) is normally a
+ * list pop. The pool is refilled by an idle-class thread, so zeroing
+ * only uses cpu time nobody else wants. If memory runs out, the pool
+ * is given back to the buddy lists before failing.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <swap.h>
+
+/* Page states. */
+#define CME_FREE	0	/* first page of a block on a free list */
+#define CME_FREETAIL	1	/* rest of a free block */
+#define CME_KERNEL	2	/* allocated */
+#define CME_ZEROED	3	/* zeroed, in the zero pool */
+
+/* Largest block order; 2^14 pages is 64M with 4K pages. */
+#define CM_MAXORDER	14
+
+/* Marks the end of a free list. */
+#define CM_NONE		((unsigned)-1)
+
+struct coremap_entry {
+	uint8_t cme_state;	/* CME_* */
+	uint8_t cme_order;	/* order of block, for CME_FREE */
+	uint16_t cme_shares;	/* extra references, for CME_KERNEL */
+	uint8_t cme_busy;	/* being paged out */
+	unsigned cme_npages;	/* run length, for first page of a run */
+	unsigned cme_next;	/* free list links, for CME_FREE */
+	unsigned cme_prev;
+	struct addrspace *cme_as;	/* owner, for user pages */
+	vaddr_t cme_vaddr;		/* where the owner maps it */
+	unsigned cme_slot;		/* swap copy of a clean page */
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;	/* NULL until bootstrapped */
+static paddr_t coremap_base;		/* physical address of page 0 */
+static unsigned coremap_npages;		/* pages managed */
+static unsigned coremap_nfree;		/* pages free */
+static unsigned freelists[CM_MAXORDER + 1];
+static unsigned freecounts[CM_MAXORDER + 1];
+static unsigned coremap_hand;		/* pageout clock hand */
+
+/* How many times coremap_alloc pages something out and retries. */
+#define CM_PAGEOUT_TRIES	4
+
+/* Most pages coremap_victim looks at with the coremap locked. */
+#define CM_VICTIM_STEPS		32
+
+/*
+ * The zero pool, linked through cme_next. The zeroing thread fills it
+ * up to zeropool_high pages, then sleeps until it drops below
+ * zeropool_low. The counters are protected by coremap_lock.
+ */
+static unsigned zeropool;		/* first page, or CM_NONE */
+static unsigned zeropool_count;
+static unsigned zeropool_low, zeropool_high;
+static struct wchan *zeropool_wchan;	/* zeroing thread sleeps here */
+static unsigned zeropool_hits;		/* zeroed allocs from the pool */
+static unsigned zeropool_misses;	/* zeroed allocs done inline */
+static unsigned zeropool_zeroed;	/* pages zeroed in the background */
+static unsigned zeropool_reclaims;	/* times drained for lack of memory */
+
+/* Pool size: 1/32 of memory, up to 128 pages. */
+#define ZEROPOOL_FRACTION	32
+#define ZEROPOOL_MAX		128
+
+////////////////////////////////////////////////////////////
+// Free lists
+
+static
+void
+freelist_add(unsigned i, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[i];
+
+	cme->cme_state = CME_FREE;
+	cme->cme_order = order;
+	cme->cme_prev = CM_NONE;
+	cme->cme_next = freelists[order];
+	if (freelists[order] != CM_NONE) {
+		coremap[freelists[order]].cme_prev = i;
+	}
+	freelists[order] = i;
+	freecounts[order]++;
+}
+
+static
+void
+freelist_remove(unsigned i)
+{
+	struct coremap_entry *cme = &coremap[i];
+	unsigned order = cme->cme_order;
+
+	KASSERT(cme->cme_state == CME_FREE);
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		KASSERT(freelists[order] == i);
+		freelists[order] = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_state = CME_FREETAIL;
+	KASSERT(freecounts[order] > 0);
+	freecounts[order]--;
+}
+
+/*
+ * Free the block of 2^ORDER pages starting at page I, merging it with
+ * its buddy as long as the buddy is free too.
+ */
+static
+void
+coremap_freeblock(unsigned i, unsigned order)
+{
+	unsigned buddy, j;
+
+	KASSERT(i % (1U << order) == 0);
+	for (j = i; j < i + (1U << order); j++) {
+		coremap[j].cme_state = CME_FREETAIL;
+	}
+	coremap_nfree += 1U << order;
+
+	while (order < CM_MAXORDER) {
+		buddy = i ^ (1U << order);
+		if (buddy + (1U << order) > coremap_npages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < i) {
+			i = buddy;
+		}
+		order++;
+	}
+	freelist_add(i, order);
+}
+
+/*
+ * Free the pages [START, END), which need not be a power of two or
+ * aligned, as the largest aligned blocks that fit.
+ */
+static
+void
+coremap_freerange(unsigned start, unsigned end)
+{
+	unsigned order;
+
+	while (start < end) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       start % (2U << order) == 0 &&
+		       start + (2U << order) <= end) {
+			order++;
+		}
+		coremap_freeblock(start, order);
+		start += 1U << order;
+	}
+}
+
+/*
+ * Take one block of at least 2^ORDER pages off the free lists and
+ * split it down to exactly that. Returns its first page, or CM_NONE.
+ */
+static
+unsigned
+coremap_getblock(unsigned order)
+{
+	unsigned i, j;
+
+	for (j = order; j <= CM_MAXORDER; j++) {
+		if (freelists[j] != CM_NONE) {
+			break;
+		}
+	}
+	if (j > CM_MAXORDER) {
+		return CM_NONE;
+	}
+
+	i = freelists[j];
+	freelist_remove(i);
+	coremap_nfree -= 1U << j;
+
+	/* Split off the upper halves until it's the right size. */
+	while (j > order) {
+		j--;
+		freelist_add(i + (1U << j), j);
+		coremap_nfree += 1U << j;
+	}
+	return i;
+}
+
+/*
+ * Give all the pages in the zero pool back to the free lists.
+ */
+static
+void
+zeropool_reclaim(void)
+{
+	unsigned i;
+
+	while (zeropool != CM_NONE) {
+		i = zeropool;
+		KASSERT(coremap[i].cme_state == CME_ZEROED);
+		zeropool = coremap[i].cme_next;
+		zeropool_count--;
+		coremap_freeblock(i, 0);
+	}
+	KASSERT(zeropool_count == 0);
+	zeropool_reclaims++;
+}
+
+/*
+ * Background zeroing thread.
+ */
+static
+void
+zeropool_thread(void *junk1, unsigned long junk2)
+{
+	unsigned i;
+
+	(void)junk1;
+	(void)junk2;
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		while (zeropool_count >= zeropool_low) {
+			wchan_sleep(zeropool_wchan, &coremap_lock);
+		}
+		while (zeropool_count < zeropool_high) {
+			/* Don't eat the last free pages. */
+			if (coremap_nfree <= zeropool_high) {
+				break;
+			}
+			i = coremap_getblock(0);
+			if (i == CM_NONE) {
+				break;
+			}
+			coremap[i].cme_state = CME_KERNEL;
+			spinlock_release(&coremap_lock);
+
+			bzero((void *)PADDR_TO_KVADDR(coremap_base +
+				(paddr_t)i * PAGE_SIZE), PAGE_SIZE);
+
+			spinlock_acquire(&coremap_lock);
+			coremap[i].cme_state = CME_ZEROED;
+			coremap[i].cme_next = zeropool;
+			zeropool = i;
+			zeropool_count++;
+			zeropool_zeroed++;
+		}
+		if (zeropool_count < zeropool_low) {
+			/*
+			 * Memory is tight. Wait for the next zeroed
+			 * allocation to come by rather than spinning.
+			 */
+			wchan_sleep(zeropool_wchan, &coremap_lock);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Set up the coremap. Called early in boot, right after
+ * ram_bootstrap; after this ram_stealmem is no longer used.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	size_t npages, mapsize;
+	unsigned i;
+
+	ram_getsize(&lo, &hi);
+	KASSERT(lo % PAGE_SIZE == 0 && hi % PAGE_SIZE == 0);
+
+	/* The coremap itself goes at the bottom of free memory. */
+	npages = (hi - lo) / PAGE_SIZE;
+	mapsize = ROUNDUP(npages * sizeof(struct coremap_entry), PAGE_SIZE);
+	KASSERT(mapsize < hi - lo);
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+	lo += mapsize;
+
+	coremap_base = lo;
+	coremap_npages = (hi - lo) / PAGE_SIZE;
+	coremap_nfree = 0;
+	for (i=0; i<=CM_MAXORDER; i++) {
+		freelists[i] = CM_NONE;
+		freecounts[i] = 0;
+	}
+	zeropool = CM_NONE;
+	zeropool_count = 0;
+	zeropool_high = coremap_npages / ZEROPOOL_FRACTION;
+	if (zeropool_high > ZEROPOOL_MAX) {
+		zeropool_high = ZEROPOOL_MAX;
+	}
+	zeropool_low = zeropool_high / 2;
+	for (i=0; i<coremap_npages; i++) {
+		coremap[i].cme_state = CME_KERNEL;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_slot = SWAP_NOSLOT;
+	}
+	coremap_hand = 0;
+
+	spinlock_acquire(&coremap_lock);
+	coremap_freerange(0, coremap_npages);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Allocate NPAGES physically contiguous pages. If there isn't a run
+ * that long free, page some user pages out (if possible) and try
+ * again. Returns 0 if that doesn't help.
+ */
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	unsigned order, j, i, tries;
+
+	KASSERT(npages > 0);
+
+	if (coremap == NULL) {
+		/* Too early; nothing is being tracked yet. */
+		return ram_stealmem(npages);
+	}
+
+	for (order = 0; (1UL << order) < npages; order++) {
+		if (order == CM_MAXORDER) {
+			return 0;
+		}
+	}
+
+	for (tries = 0; ; tries++) {
+		spinlock_acquire(&coremap_lock);
+		i = coremap_getblock(order);
+		if (i == CM_NONE && zeropool != CM_NONE) {
+			zeropool_reclaim();
+			i = coremap_getblock(order);
+		}
+		if (i != CM_NONE) {
+			break;
+		}
+		spinlock_release(&coremap_lock);
+
+		if (tries == CM_PAGEOUT_TRIES || vm_pageout() == 0) {
+			return 0;
+		}
+	}
+
+	/* Give back whatever we don't need off the end. */
+	coremap_freerange(i + npages, i + (1U << order));
+
+	for (j = i; j < i + npages; j++) {
+		coremap[j].cme_state = CME_KERNEL;
+		coremap[j].cme_npages = 0;
+	}
+	coremap[i].cme_npages = npages;
+	coremap[i].cme_shares = 0;
+	coremap[i].cme_busy = 0;
+
+	spinlock_release(&coremap_lock);
+
+	return coremap_base + (paddr_t)i * PAGE_SIZE;
+}
+
+/*
+ * Like coremap_alloc, but the pages are zero-filled. A single page
+ * comes from the zero pool if it has one.
+ */
+paddr_t
+coremap_alloc_zeroed(unsigned long npages)
+{
+	paddr_t pa;
+	unsigned i;
+
+	if (npages == 1 && coremap != NULL) {
+		spinlock_acquire(&coremap_lock);
+		i = zeropool;
+		if (i != CM_NONE) {
+			KASSERT(coremap[i].cme_state == CME_ZEROED);
+			zeropool = coremap[i].cme_next;
+			zeropool_count--;
+			zeropool_hits++;
+			coremap[i].cme_state = CME_KERNEL;
+			coremap[i].cme_npages = 1;
+			coremap[i].cme_shares = 0;
+			coremap[i].cme_busy = 0;
+		}
+		else {
+			zeropool_misses++;
+		}
+		if (zeropool_count < zeropool_low && zeropool_wchan != NULL) {
+			wchan_wakeone(zeropool_wchan, &coremap_lock);
+		}
+		spinlock_release(&coremap_lock);
+		if (i != CM_NONE) {
+			return coremap_base + (paddr_t)i * PAGE_SIZE;
+		}
+	}
+	else if (coremap != NULL) {
+		spinlock_acquire(&coremap_lock);
+		zeropool_misses += npages;
+		spinlock_release(&coremap_lock);
+	}
+
+	pa = coremap_alloc(npages);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), npages * PAGE_SIZE);
+	}
+	return pa;
+}
+
+/*
+ * Start the zeroing thread. Called once threads and wchans work.
+ */
+void
+coremap_zero_bootstrap(void)
+{
+	struct wchan *wc;
+	int result;
+
+	wc = wchan_create("zeropool");
+	if (wc == NULL) {
+		panic("coremap: Could not create zero pool wchan\n");
+	}
+	spinlock_acquire(&coremap_lock);
+	zeropool_wchan = wc;
+	spinlock_release(&coremap_lock);
+
+	result = thread_fork_idle("pagezero", NULL, zeropool_thread, NULL, 0);
+	if (result) {
+		panic("coremap: Could not start zeroing thread: %s\n",
+		      strerror(result));
+	}
+}
+
+/*
+ * Free a run of pages returned by coremap_alloc. If it's a shared
+ * page, this just drops one reference.
+ */
+void
+coremap_free(paddr_t pa)
+{
+	unsigned i, npages;
+
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	if (coremap == NULL || pa < coremap_base) {
+		/* Stolen before the coremap existed; can't free it. */
+		return;
+	}
+
+	i = (pa - coremap_base) / PAGE_SIZE;
+	KASSERT(i < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	npages = coremap[i].cme_npages;
+	if (coremap[i].cme_state != CME_KERNEL || npages == 0) {
+		panic("coremap_free: 0x%lx is not the start of a run\n",
+		      (unsigned long)pa);
+	}
+	if (coremap[i].cme_shares > 0) {
+		coremap[i].cme_shares--;
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	KASSERT(i + npages <= coremap_npages);
+	KASSERT(coremap[i].cme_slot == SWAP_NOSLOT);
+	coremap[i].cme_as = NULL;
+	coremap[i].cme_npages = 0;
+	coremap_freerange(i, i + npages);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to the single page at PA, which must have come from
+ * coremap_alloc. Each reference is dropped with coremap_free.
+ */
+void
+coremap_share(paddr_t pa)
+{
+	unsigned i;
+
+	KASSERT(coremap != NULL && pa >= coremap_base);
+	i = (pa - coremap_base) / PAGE_SIZE;
+	KASSERT(i < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[i].cme_state == CME_KERNEL);
+	KASSERT(coremap[i].cme_npages == 1);
+	KASSERT(coremap[i].cme_shares < 0xffff);
+	KASSERT(coremap[i].cme_slot == SWAP_NOSLOT);
+	coremap[i].cme_shares++;
+	/* Nobody owns it alone any more, so it can't be paged out. */
+	coremap[i].cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Check if the page at PA has more than one reference. If the caller
+ * holds a reference, a true answer can go stale (another holder lets
+ * go) but a false one can't, since only a holder can share the page.
+ */
+bool
+coremap_isshared(paddr_t pa)
+{
+	unsigned i;
+	bool ret;
+
+	KASSERT(coremap != NULL && pa >= coremap_base);
+	i = (pa - coremap_base) / PAGE_SIZE;
+	KASSERT(i < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap[i].cme_shares > 0;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Look up the coremap index of an allocated single page.
+ */
+static
+unsigned
+coremap_index(paddr_t pa)
+{
+	unsigned i;
+
+	KASSERT(coremap != NULL && pa >= coremap_base);
+	KASSERT(pa % PAGE_SIZE == 0);
+	i = (pa - coremap_base) / PAGE_SIZE;
+	KASSERT(i < coremap_npages);
+	KASSERT(coremap[i].cme_state == CME_KERNEL);
+	return i;
+}
+
+/*
+ * Record that the single, unshared page at PA is mapped by AS at
+ * VADDR, making it a candidate for pageout. AS may be NULL to make
+ * it not a candidate.
+ */
+void
+coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i = coremap_index(pa);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(as == NULL || coremap[i].cme_shares == 0);
+	coremap[i].cme_as = as;
+	coremap[i].cme_vaddr = vaddr;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Attach the swap slot holding a copy of the page at PA, or take it
+ * back off (returning SWAP_NOSLOT if there wasn't one). A page must
+ * not be freed with a slot attached.
+ */
+void
+coremap_setslot(paddr_t pa, unsigned slot)
+{
+	unsigned i = coremap_index(pa);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[i].cme_slot == SWAP_NOSLOT);
+	coremap[i].cme_slot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_takeslot(paddr_t pa)
+{
+	unsigned i = coremap_index(pa);
+	unsigned slot;
+
+	spinlock_acquire(&coremap_lock);
+	slot = coremap[i].cme_slot;
+	coremap[i].cme_slot = SWAP_NOSLOT;
+	spinlock_release(&coremap_lock);
+	return slot;
+}
+
+/*
+ * Advance the pageout clock hand to the next owned, unshared page
+ * that isn't busy and whose owner CLAIM accepts, mark it busy, and
+ * return it with its owner in *AS and *VADDR. CLAIM is called with
+ * the coremap locked (so the owner can't go away while it looks) and
+ * must not sleep; it's how the caller gets the owner's lock.
+ *
+ * The coremap lock keeps interrupts off, so the hand moves at most
+ * CM_VICTIM_STEPS pages per call; if none of them will do, this
+ * returns 0 and the caller decides whether to keep going. The pages
+ * looked at are added to *STEPS either way.
+ */
+paddr_t
+coremap_victim(bool (*claim)(struct addrspace *as, void *data), void *data,
+	       unsigned *steps, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned n, i;
+
+	if (coremap == NULL) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (n=0; n<CM_VICTIM_STEPS && n<coremap_npages; n++) {
+		i = coremap_hand;
+		coremap_hand = (coremap_hand + 1) % coremap_npages;
+		cme = &coremap[i];
+		if (cme->cme_state != CME_KERNEL || cme->cme_npages != 1 ||
+		    cme->cme_as == NULL || cme->cme_shares > 0 ||
+		    cme->cme_busy) {
+			continue;
+		}
+		if (!claim(cme->cme_as, data)) {
+			continue;
+		}
+		cme->cme_busy = 1;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		*steps += n + 1;
+		return coremap_base + (paddr_t)i * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	*steps += n;
+	return 0;
+}
+
+/*
+ * Put back a page coremap_victim returned without freeing it.
+ */
+void
+coremap_unbusy(paddr_t pa)
+{
+	unsigned i = coremap_index(pa);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[i].cme_busy);
+	coremap[i].cme_busy = 0;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of free pages, counting the zero pool.
+ */
+unsigned
+coremap_freepages(void)
+{
+	unsigned ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_nfree + zeropool_count;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Print how much memory is free and how it's split up.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned i, total, nfree;
+	unsigned counts[CM_MAXORDER + 1];
+	unsigned zcount, zhits, zmisses, zzeroed, zreclaims;
+
+	if (coremap == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	total = coremap_npages;
+	nfree = coremap_nfree;
+	for (i=0; i<=CM_MAXORDER; i++) {
+		counts[i] = freecounts[i];
+	}
+	zcount = zeropool_count;
+	zhits = zeropool_hits;
+	zmisses = zeropool_misses;
+	zzeroed = zeropool_zeroed;
+	zreclaims = zeropool_reclaims;
+	spinlock_release(&coremap_lock);
+
+	kprintf("Physical memory: %u pages, %u free, %u in use\n",
+		total, nfree, total - nfree);
+	kprintf("Free blocks by size (pages):");
+	for (i=0; i<=CM_MAXORDER; i++) {
+		if (counts[i] > 0) {
+			kprintf(" %u:%u", 1U << i, counts[i]);
+		}
+	}
+	kprintf("\n");
+	kprintf("Zero pool: %u pages; %u hits, %u misses, %u zeroed, "
+		"%u reclaims\n", zcount, zhits, zmisses, zzeroed, zreclaims);
+}
@@ -30,7 +30,13 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <kmemcache.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -102,6 +108,11 @@ fill_deadbeef(void *vptr, size_t len)
  * LABELS records the allocation site and a generation number for each
  * allocation and is useful for tracking down memory leaks.
  *
+ * PROFILE enables LABELS and also keeps running totals of live memory
+ * and allocation counts per allocation site and per block size, for
+ * kheap_printprofile. This finds out who is using the heap and how
+ * much of it is lost to rounding up to block sizes.
+ *
  * On top of these one can enable the following:
  *
  * CHECKBEEF checks that free blocks still contain 0xdeadbeef when
@@ -117,6 +128,7 @@ fill_deadbeef(void *vptr, size_t len)
 #undef SLOWER
 #undef GUARDS
 #undef LABELS
+#undef PROFILE
 
 #undef CHECKBEEF
 #undef CHECKGUARDS
@@ -160,10 +172,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for all the heap pages and pagerefs. The common
+ * case of kmalloc and kfree doesn't get here at all but is handled by
+ * per-cpu magazines of free blocks (see below).
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -212,6 +223,23 @@ struct kheap_root {
 
 static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
 
+/*
+ * Map from page to pageref for heap pages, so kfree can find the page
+ * a block is on without searching (or locking). For the same reason
+ * as above this only covers the first 16M of physical memory; pages
+ * above that, if there are any, are found by searching allbase.
+ */
+
+#define KHEAP_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+#define KHEAP_PAGEINDEX(va) (((va) - PADDR_TO_KVADDR(0)) / PAGE_SIZE)
+
+static struct pageref *kheap_pagemap[KHEAP_MAXPAGES];
+
+/*
+ * Largest number of blocks a per-cpu magazine holds.
+ */
+#define KMAG_MAXROUNDS	16
+
 /*
  * Allocate a page to hold pagerefs.
  */
@@ -450,6 +478,13 @@ checkguardband(vaddr_t blockaddr, size_t smallerblocksize, size_t blocksize)
 #endif
 #endif
 
+/* PROFILE implies LABELS */
+#ifdef PROFILE
+#ifndef LABELS
+#define LABELS
+#endif
+#endif
+
 #ifdef CHECKBEEF
 /*
  * Check that a (free) block contains deadbeef as it should.
@@ -471,6 +506,27 @@ checkdeadbeef(void *block, size_t blocksize)
 #endif /* CHECKBEEF */
 
 #ifdef SLOW
+#ifdef CHECKGUARDS
+/*
+ * Check if a block is entirely 0xdeadbeef, as a free block held in a
+ * magazine is.
+ */
+static
+bool
+isdeadbeef(vaddr_t block, size_t blocksize)
+{
+	const uint32_t *ptr = (const uint32_t *)block;
+	size_t i;
+
+	for (i=0; i<blocksize/sizeof(uint32_t); i++) {
+		if (ptr[i] != 0xdeadbeef) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif /* CHECKGUARDS */
+
 /*
  * Check that a particular heap page (the one managed by the argument
  * PR) is valid.
@@ -559,7 +615,15 @@ checksubpage(struct pageref *pr)
 	numblocks = PAGE_SIZE / blocksize;
 	for (i=0; i<numblocks; i++) {
 		mask = 1U << (i % 32);
-		if ((isfree[i / 32] & mask) == 0) {
+		if ((isfree[i / 32] & mask) != 0) {
+			continue;
+		}
+		/*
+		 * Not on the freelist: either allocated, or free in some
+		 * cpu's magazine, in which case it is all deadbeef (see
+		 * subpage_getblocks).
+		 */
+		if (!isdeadbeef(prpage + i * blocksize, blocksize)) {
 			checkguardband(prpage + i * blocksize,
 				       smallerblocksize, blocksize);
 		}
@@ -615,6 +679,10 @@ checksubpages(void)
 struct malloclabel {
 	vaddr_t label;
 	unsigned generation;
+#ifdef PROFILE
+	unsigned reqsize;	/* size the caller asked for */
+	unsigned pad;		/* keep the size a multiple of 8 */
+#endif
 };
 
 static unsigned mallocgeneration;
@@ -697,6 +765,230 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
+////////////////////////////////////////
+
+#ifdef PROFILE
+
+/*
+ * Allocation profile.
+ *
+ * Allocation sites are kept in a small open-addressed hash table
+ * keyed on the return address of the kmalloc call. If it fills up,
+ * allocations from further sites are counted only per block size.
+ * All of this has its own spinlock so as not to serialize the
+ * magazine fast path on kmalloc_spinlock.
+ */
+
+#define KPROF_NSITES 256	/* must be a power of 2 */
+#define KPROF_NTOP   20		/* sites kheap_printprofile shows */
+
+struct kprof_site {
+	vaddr_t ks_site;	/* caller; 0 if slot unused */
+	unsigned ks_liveblocks;	/* blocks currently allocated */
+	size_t ks_livereq;	/* bytes asked for in those */
+	size_t ks_liveblk;	/* bytes of block they occupy */
+	unsigned ks_allocs;	/* allocations since reset */
+};
+
+struct kprof_size {
+	unsigned kz_liveblocks;	/* blocks currently allocated */
+	size_t kz_livereq;	/* bytes asked for in those */
+	unsigned kz_allocs;	/* allocations since reset */
+};
+
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+static struct kprof_site kprof_sites[KPROF_NSITES];
+static struct kprof_size kprof_sizes[NSIZES];
+static unsigned kprof_lostsites;	/* allocs with no site slot */
+static uint64_t kprof_start;		/* time of last reset */
+
+/*
+ * Find (or make) the table entry for SITE. NULL if the table is full.
+ */
+static
+struct kprof_site *
+kprof_lookup(vaddr_t site)
+{
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	i = (site >> 2) & (KPROF_NSITES - 1);
+	for (n = 0; n < KPROF_NSITES; n++) {
+		if (kprof_sites[i].ks_site == site) {
+			return &kprof_sites[i];
+		}
+		if (kprof_sites[i].ks_site == 0) {
+			kprof_sites[i].ks_site = site;
+			return &kprof_sites[i];
+		}
+		i = (i + 1) & (KPROF_NSITES - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Record an allocation (ALLOC true) or free of a block of type
+ * BLKTYPE from SITE, of which the caller asked for REQSIZE bytes.
+ */
+static
+void
+kprof_record(vaddr_t site, unsigned blktype, size_t reqsize, bool alloc)
+{
+	struct kprof_site *ks;
+	struct kprof_size *kz = &kprof_sizes[blktype];
+
+	spinlock_acquire(&kprof_lock);
+	if (kprof_start == 0) {
+		kprof_start = gettime_ns();
+	}
+	ks = kprof_lookup(site);
+	if (alloc) {
+		kz->kz_liveblocks++;
+		kz->kz_livereq += reqsize;
+		kz->kz_allocs++;
+		if (ks != NULL) {
+			ks->ks_liveblocks++;
+			ks->ks_livereq += reqsize;
+			ks->ks_liveblk += sizes[blktype];
+			ks->ks_allocs++;
+		}
+		else {
+			kprof_lostsites++;
+		}
+	}
+	else {
+		KASSERT(kz->kz_liveblocks > 0);
+		kz->kz_liveblocks--;
+		kz->kz_livereq -= reqsize;
+		if (ks != NULL && ks->ks_liveblocks > 0) {
+			ks->ks_liveblocks--;
+			ks->ks_livereq -= reqsize;
+			ks->ks_liveblk -= sizes[blktype];
+		}
+	}
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Allocations per second over ELAPSED nanoseconds.
+ */
+static
+unsigned
+kprof_rate(unsigned count, uint64_t elapsed)
+{
+	if (elapsed == 0) {
+		return 0;
+	}
+	return (uint64_t)count * 1000000000 / elapsed;
+}
+
+#endif /* PROFILE */
+
+/*
+ * Print the allocation profile: for each block size, the live
+ * blocks, bytes asked for versus bytes used, and allocation rate;
+ * then the allocation sites holding the most memory.
+ */
+void
+kheap_printprofile(void)
+{
+#ifdef PROFILE
+	struct kprof_site *top, tmp;
+	struct kprof_size kz;
+	uint64_t elapsed;
+	unsigned i, j, ntop, lost;
+	size_t blkbytes;
+
+	top = kmalloc(KPROF_NSITES * sizeof(*top));
+	if (top == NULL) {
+		kprintf("kheap_printprofile: Out of memory\n");
+		return;
+	}
+
+	kprintf("%6s %8s %10s %10s %5s %8s %7s\n", "SIZE", "LIVE",
+		"REQUESTED", "USED", "FRAG%", "ALLOCS", "PER-SEC");
+
+	spinlock_acquire(&kprof_lock);
+	elapsed = kprof_start ? gettime_ns() - kprof_start : 0;
+	for (i=0; i<NSIZES; i++) {
+		kz = kprof_sizes[i];
+		blkbytes = kz.kz_liveblocks * sizes[i];
+		kprintf("%6lu %8u %10lu %10lu %5u %8u %7u\n",
+			(unsigned long)sizes[i], kz.kz_liveblocks,
+			(unsigned long)kz.kz_livereq, (unsigned long)blkbytes,
+			blkbytes ?
+			(unsigned)(100 - kz.kz_livereq * 100 / blkbytes) : 0,
+			kz.kz_allocs, kprof_rate(kz.kz_allocs, elapsed));
+	}
+
+	/* Copy out the used slots, then sort by live bytes. */
+	ntop = 0;
+	for (i=0; i<KPROF_NSITES; i++) {
+		if (kprof_sites[i].ks_site != 0) {
+			top[ntop++] = kprof_sites[i];
+		}
+	}
+	lost = kprof_lostsites;
+	spinlock_release(&kprof_lock);
+
+	for (i=1; i<ntop; i++) {
+		tmp = top[i];
+		for (j=i; j>0 && top[j-1].ks_livereq < tmp.ks_livereq; j--) {
+			top[j] = top[j-1];
+		}
+		top[j] = tmp;
+	}
+
+	kprintf("\nTop allocation sites by live bytes:\n");
+	kprintf("%-10s %8s %10s %10s %5s %8s %7s\n", "SITE", "LIVE",
+		"REQUESTED", "USED", "FRAG%", "ALLOCS", "PER-SEC");
+	for (i=0; i<ntop && i<KPROF_NTOP; i++) {
+		kprintf("0x%08lx %8u %10lu %10lu %5u %8u %7u\n",
+			(unsigned long)top[i].ks_site, top[i].ks_liveblocks,
+			(unsigned long)top[i].ks_livereq,
+			(unsigned long)top[i].ks_liveblk,
+			top[i].ks_liveblk ?
+			(unsigned)(100 - top[i].ks_livereq * 100 /
+				   top[i].ks_liveblk) : 0,
+			top[i].ks_allocs, kprof_rate(top[i].ks_allocs, elapsed));
+	}
+	if (lost > 0) {
+		kprintf("(%u allocations from sites that didn't fit "
+			"in the table)\n", lost);
+	}
+	kprintf("Large (whole-page) allocations are not profiled.\n");
+
+	kfree(top);
+#else
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+/*
+ * Start the allocation counts and rates over. Live totals are kept.
+ */
+void
+kheap_resetprofile(void)
+{
+#ifdef PROFILE
+	unsigned i;
+
+	spinlock_acquire(&kprof_lock);
+	for (i=0; i<KPROF_NSITES; i++) {
+		kprof_sites[i].ks_allocs = 0;
+	}
+	for (i=0; i<NSIZES; i++) {
+		kprof_sizes[i].kz_allocs = 0;
+	}
+	kprof_lostsites = 0;
+	kprof_start = gettime_ns();
+	spinlock_release(&kprof_lock);
+#else
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_nextgeneration(void)
 {
@@ -794,6 +1086,8 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+static void kmag_printstats(void);
+
 /*
  * Print the whole heap.
  */
@@ -803,6 +1097,8 @@ kheap_printstats(void)
 	struct pageref *pr;
 
 	/* print the whole thing with interrupts off */
+	coremap_printstats();
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
@@ -812,6 +1108,9 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kmag_printstats();
+	kmem_cache_printstats();
 }
 
 ////////////////////////////////////////
@@ -867,41 +1166,66 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Find the pageref for the heap page containing PTRADDR, if any.
+ *
+ * Pages inside the range covered by kheap_pagemap[] are looked up
+ * there, which needs no lock; this is the common case and is what
+ * lets kfree pick a magazine without touching kmalloc_spinlock. The
+ * map is only changed while the page has no blocks allocated, so a
+ * caller freeing a valid block can't race with it. Anything outside
+ * that range falls back to searching the list of all pages, which
+ * does need the lock.
+ */
+static
+struct pageref *
+subpage_lookup(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+	vaddr_t index;
+
+	index = KHEAP_PAGEINDEX(ptraddr);
+	if (index < KHEAP_MAXPAGES) {
+		pr = kheap_pagemap[index];
+		if (pr != NULL) {
+			KASSERT(ptraddr - PR_PAGEADDR(pr) < PAGE_SIZE);
+		}
+		return pr;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = allbase; pr; pr = pr->next_all) {
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= PR_PAGEADDR(pr) &&
+		    ptraddr < PR_PAGEADDR(pr) + PAGE_SIZE) {
+			break;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+	return pr;
+}
+
+/*
+ * Take one free block of type BLKTYPE off the heap pages. Must be
+ * called with kmalloc_spinlock held; it is released and reacquired if
+ * a fresh page is needed. Returns NULL if out of memory.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_getblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	vaddr_t index;		// page's slot in kheap_pagemap[]
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	checksubpages();
 
@@ -934,16 +1258,9 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
 
 			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
 			return retptr;
 		}
 	}
@@ -962,6 +1279,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -977,6 +1295,7 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1007,10 +1326,455 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	index = KHEAP_PAGEINDEX(prpage);
+	if (index < KHEAP_MAXPAGES) {
+		KASSERT(kheap_pagemap[index] == NULL);
+		kheap_pagemap[index] = pr;
+	}
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Put the block at PTRADDR back on its heap page PR. Must be called
+ * with kmalloc_spinlock held. If this makes the whole page free, the
+ * page is taken out of the heap and its address is returned; the
+ * caller should pass it to free_kpages after releasing the lock.
+ * Otherwise returns 0.
+ *
+ * The block should already have been checked and deadbeefed.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+	vaddr_t index;		// page's slot in kheap_pagemap[]
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	checksubpages();
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		index = KHEAP_PAGEINDEX(prpage);
+		if (index < KHEAP_MAXPAGES) {
+			KASSERT(kheap_pagemap[index] == pr);
+			kheap_pagemap[index] = NULL;
+		}
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		return prpage;
+	}
+
+	checksubpages();
+
+	return 0;
+}
+
+/*
+ * Get up to NUM free blocks of type BLKTYPE from the heap pages into
+ * BLOCKS. Returns how many it got, which is less than NUM only if
+ * we're out of memory.
+ *
+ * With CHECKGUARDS the blocks are deadbeefed all over, freelist
+ * pointer included, so checksubpage can tell the ones that end up
+ * in magazines from allocated blocks by their contents.
+ */
+static
+unsigned
+subpage_getblocks(unsigned blktype, void **blocks, unsigned num)
+{
+	unsigned got;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (got = 0; got < num; got++) {
+		blocks[got] = subpage_getblock(blktype);
+		if (blocks[got] == NULL) {
+			break;
+		}
+#ifdef CHECKGUARDS
+		fill_deadbeef(blocks[got], sizes[blktype]);
+#endif
+	}
+	spinlock_release(&kmalloc_spinlock);
+	return got;
+}
+
+/*
+ * Return NUM blocks from BLOCKS to their heap pages.
+ */
+static
+void
+subpage_putblocks(void **blocks, unsigned num)
+{
+	struct pageref *prs[KMAG_MAXROUNDS];
+	vaddr_t freepage;
+	unsigned i;
+
+	/* The blocks are still allocated, so their pages can't go away. */
+	KASSERT(num <= KMAG_MAXROUNDS);
+	for (i=0; i<num; i++) {
+		prs[i] = subpage_lookup((vaddr_t)blocks[i]);
+		KASSERT(prs[i] != NULL);
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<num; i++) {
+		freepage = subpage_putblock(prs[i], (vaddr_t)blocks[i]);
+		if (freepage != 0) {
+			/* Call free_kpages without kmalloc_spinlock. */
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(freepage);
+			spinlock_acquire(&kmalloc_spinlock);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps a small stack ("magazine") of free blocks of each
+ * size. kmalloc takes from it and kfree pushes onto it, touching only
+ * per-cpu state with interrupts off, so the common case never takes
+ * kmalloc_spinlock or walks the page lists. When a magazine is empty
+ * it is refilled with half its capacity of blocks in one trip to the
+ * heap pages; when full, half of it is drained back the same way.
+ * Refilling and draining are done with interrupts on, since they may
+ * need to call alloc_kpages or free_kpages.
+ *
+ * Blocks in magazines count as allocated as far as the heap pages are
+ * concerned, so a page isn't released while some cpu is holding on
+ * to one of its blocks. To bound how much memory is tied up that way
+ * the capacity is smaller for the larger sizes (kmag_capacity).
+ *
+ * The per-cpu structures are allocated from the heap pages the first
+ * time each cpu goes down the slow path. Before that, and before
+ * curcpu exists at all, everything goes straight to the heap pages.
+ */
+
+struct kmag {
+	unsigned km_count;		/* blocks in km_rounds[] */
+	void *km_rounds[KMAG_MAXROUNDS];	/* free blocks */
+	unsigned km_hits;		/* allocs+frees without the lock */
+	unsigned km_refills;		/* trips to the pages to refill */
+	unsigned km_drains;		/* trips to the pages to drain */
+};
+
+struct kmalloc_cpu {
+	struct kmag kc_mags[NSIZES];
+};
+
+static struct kmalloc_cpu *kmalloc_cpus[MAXCPUS];
+
+/*
+ * How many blocks the magazine for BLKTYPE holds at most: two pages'
+ * worth, up to KMAG_MAXROUNDS.
+ */
+static
+inline
+unsigned
+kmag_capacity(unsigned blktype)
+{
+	unsigned cap;
+
+	cap = 2 * (PAGE_SIZE / sizes[blktype]);
+	return cap < KMAG_MAXROUNDS ? cap : KMAG_MAXROUNDS;
+}
+
+/*
+ * Get the current cpu's magazine structure, creating it if necessary.
+ * Returns NULL if there isn't one and it can't be made now. Called
+ * with interrupts on.
+ */
+static
+struct kmalloc_cpu *
+kmalloc_getcpu(void)
+{
+	struct kmalloc_cpu *kc;
+	unsigned cpunum;
+	void *block;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	cpunum = curcpu->c_number;
+	KASSERT(cpunum < MAXCPUS);
+	if (kmalloc_cpus[cpunum] != NULL) {
+		return kmalloc_cpus[cpunum];
+	}
+
+	if (subpage_getblocks(blocktype(sizeof(*kc)), &block, 1) == 0) {
+		return NULL;
+	}
+	kc = block;
+	bzero(kc, sizeof(*kc));
+
+	spinlock_acquire(&kmalloc_spinlock);
+	if (kmalloc_cpus[cpunum] == NULL) {
+		kmalloc_cpus[cpunum] = kc;
+		kc = NULL;
+	}
+	spinlock_release(&kmalloc_spinlock);
+	if (kc != NULL) {
+		/* Someone else beat us to it (we were preempted). */
+		fill_deadbeef(block, sizes[blocktype(sizeof(*kc))]);
+		subpage_putblocks(&block, 1);
+	}
+	return kmalloc_cpus[cpunum];
+}
+
+/*
+ * Get a free block of type BLKTYPE, from this cpu's magazine if
+ * possible.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	void *blocks[KMAG_MAXROUNDS];
+	struct kmag *mag;
+	unsigned num, got;
+	void *ret;
+	int spl;
+
+	if (CURCPU_EXISTS()) {
+		spl = splhigh();
+		if (kmalloc_cpus[curcpu->c_number] != NULL) {
+			mag = &kmalloc_cpus[curcpu->c_number]->kc_mags[blktype];
+			if (mag->km_count > 0) {
+				ret = mag->km_rounds[--mag->km_count];
+				mag->km_hits++;
+				splx(spl);
+				return ret;
+			}
+		}
+		splx(spl);
+	}
+
+	/* Empty: refill from the pages, and keep all but one. */
+	if (kmalloc_getcpu() == NULL) {
+		return subpage_getblocks(blktype, blocks, 1) ? blocks[0] : NULL;
+	}
+
+	num = kmag_capacity(blktype) / 2;
+	got = subpage_getblocks(blktype, blocks, num);
+	if (got == 0) {
+		return NULL;
+	}
+	ret = blocks[--got];
+
+	/*
+	 * We may be on a different cpu by now; that's fine, unless
+	 * that one hasn't got its magazines yet.
+	 */
+	spl = splhigh();
+	if (kmalloc_cpus[curcpu->c_number] != NULL) {
+		mag = &kmalloc_cpus[curcpu->c_number]->kc_mags[blktype];
+		mag->km_refills++;
+		while (got > 0 && mag->km_count < kmag_capacity(blktype)) {
+			mag->km_rounds[mag->km_count++] = blocks[--got];
+		}
+	}
+	splx(spl);
+
+	if (got > 0) {
+		/* No room after all; give the rest back. */
+		subpage_putblocks(blocks, got);
+	}
+	return ret;
+}
+
+/*
+ * Free a block of type BLKTYPE to this cpu's magazine, or if it's
+ * full, drain half of it back to the pages first.
+ */
+static
+void
+kmag_free(unsigned blktype, void *block)
+{
+	void *blocks[KMAG_MAXROUNDS];
+	struct kmag *mag;
+	unsigned num;
+	int spl;
+
+	if (kmalloc_getcpu() == NULL) {
+		subpage_putblocks(&block, 1);
+		return;
+	}
+
+	spl = splhigh();
+	if (kmalloc_cpus[curcpu->c_number] == NULL) {
+		/* Moved to a cpu that hasn't got its magazines yet. */
+		splx(spl);
+		subpage_putblocks(&block, 1);
+		return;
+	}
+	mag = &kmalloc_cpus[curcpu->c_number]->kc_mags[blktype];
+
+#ifdef SLOW
+	for (num=0; num<mag->km_count; num++) {
+		/* this block should not already be in the magazine! */
+		KASSERT(mag->km_rounds[num] != block);
+	}
+#endif
+
+	if (mag->km_count < kmag_capacity(blktype)) {
+		mag->km_rounds[mag->km_count++] = block;
+		mag->km_hits++;
+		splx(spl);
+		return;
+	}
+
+	/* Full: take half of it (oldest first) plus this block back. */
+	num = kmag_capacity(blktype) / 2;
+	memcpy(blocks, mag->km_rounds, num * sizeof(blocks[0]));
+	mag->km_count -= num;
+	memmove(mag->km_rounds, mag->km_rounds + num,
+		mag->km_count * sizeof(mag->km_rounds[0]));
+	mag->km_rounds[mag->km_count++] = block;
+	mag->km_drains++;
+	splx(spl);
+
+	subpage_putblocks(blocks, num);
+}
+
+/*
+ * Print the magazine statistics for each block size, summed over all
+ * cpus. Blocks shown as allocated by kheap_printstats include the
+ * ones held here. Read without locking, so only approximate.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmag *mag;
+	unsigned blktype, i;
+	unsigned held, hits, refills, drains;
+
+	kprintf("Per-cpu magazines:\n");
+	kprintf("%6s %6s %10s %8s %8s\n",
+		"SIZE", "HELD", "FAST", "REFILLS", "DRAINS");
+	for (blktype = 0; blktype < NSIZES; blktype++) {
+		held = hits = refills = drains = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			if (kmalloc_cpus[i] == NULL) {
+				continue;
+			}
+			mag = &kmalloc_cpus[i]->kc_mags[blktype];
+			held += mag->km_count;
+			hits += mag->km_hits;
+			refills += mag->km_refills;
+			drains += mag->km_drains;
+		}
+		kprintf("%6lu %6u %10u %8u %8u\n",
+			(unsigned long)sizes[blktype], held, hits,
+			refills, drains);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+#ifdef PROFILE
+	size_t reqsz = sz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+	sz = sizes[blktype];
+
+	retptr = kmag_alloc(blktype);
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+#ifdef PROFILE
+	((struct malloclabel *)retptr)[-1].reqsize = reqsz;
+	kprof_record(label, blktype, reqsz, true);
+#endif
+
+	return retptr;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1023,8 +1787,6 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
@@ -1055,30 +1817,15 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = subpage_lookup(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1092,59 +1839,22 @@ subpage_kfree(void *ptr)
 	checkguardband(ptraddr, smallerblocksize, blocksize);
 #endif
 
+#ifdef PROFILE
+	{
+		struct malloclabel *ml;
+
+		ml = (struct malloclabel *)((vaddr_t)ptr - LABEL_PTROFFSET);
+		kprof_record(ml->label, blktype, ml->reqsize, false);
+	}
+#endif
+
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
 	 * uses of dangling pointers.
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
-
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
-#endif
+	kmag_free(blktype, (void *)ptraddr);
 
 	return 0;
 }
@@ -1195,6 +1905,22 @@ kmalloc(size_t sz)
 #endif
 }
 
+/*
+ * Return the amount of memory kmalloc uses for a request of SZ bytes:
+ * the block size it goes in, or whole pages for large requests.
+ */
+size_t
+kmalloc_blocksize(size_t sz)
+{
+	size_t checksz;
+
+	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
+	if (checksz >= LARGEST_SUBPAGE_SIZE) {
+		return ROUNDUP(sz, PAGE_SIZE);
+	}
+	return sizes[blocktype(checksz)];
+}
+
 /*
  * Free a block previously returned from kmalloc.
  */
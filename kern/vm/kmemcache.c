@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Typed object caches (slab allocator).
+ *
+ * Each cache gets whole pages from alloc_kpages and carves them into
+ * objects of its own size. The page is described by a struct
+ * kmem_slab kept at its end, so the slab for an object is found by
+ * rounding the object's address down to the page. Each cache has its
+ * own spinlock.
+ *
+ * Free objects on a slab are kept on a list. Without a constructor
+ * the link goes in the first word of the free object; with one, it
+ * goes in an extra word after the object so the constructed state is
+ * left alone.
+ *
+ * Slabs are on one of three lists: partly used (allocate from these
+ * first), full, and empty. One empty slab is kept around so an
+ * alloc/free pair at a slab boundary doesn't keep going back to the
+ * page allocator; beyond that, empty slabs are released.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmemcache.h>
+
+/* Alignment given when the caller passes 0; same as kmalloc's. */
+#define KMEM_DEFALIGN	8
+
+/* How many empty slabs a cache keeps. */
+#define KMEM_MAXEMPTY	1
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* on the cache's slab list */
+	struct kmem_slab *ks_prev;
+	struct kmem_slab **ks_list;	/* which list */
+	struct kmem_cache *ks_cache;	/* cache we belong to */
+	void *ks_free;			/* free objects */
+	unsigned ks_inuse;		/* number of allocated objects */
+};
+
+struct kmem_cache {
+	const char *kc_name;		/* for printing */
+	size_t kc_size;			/* object size as requested */
+	size_t kc_stride;		/* distance between objects */
+	size_t kc_linkoff;		/* where the free list link goes */
+	unsigned kc_perslab;		/* objects per slab */
+	void (*kc_ctor)(void *obj);	/* constructor, or NULL */
+
+	struct spinlock kc_lock;	/* protects the rest */
+	struct kmem_slab *kc_partial;	/* slabs with some free objects */
+	struct kmem_slab *kc_full;	/* slabs with no free objects */
+	struct kmem_slab *kc_empty;	/* slabs with no used objects */
+	unsigned kc_nslabs;		/* total slabs */
+	unsigned kc_nempty;		/* slabs on kc_empty */
+	unsigned kc_inuse;		/* allocated objects */
+
+	struct kmem_cache *kc_next;	/* on allcaches */
+};
+
+/* All caches, for kmem_cache_printstats. */
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *allcaches;
+
+#define SLAB_OF(obj) \
+	((struct kmem_slab *)(((vaddr_t)(obj) & PAGE_FRAME) + PAGE_SIZE - \
+			      sizeof(struct kmem_slab)))
+#define SLAB_PAGE(ks)	((vaddr_t)(ks) & PAGE_FRAME)
+#define OBJ_LINK(kc, obj) ((void **)((char *)(obj) + (kc)->kc_linkoff))
+
+////////////////////////////////////////////////////////////
+// Slab lists
+
+static
+void
+slab_insert(struct kmem_slab **list, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = *list;
+	if (*list != NULL) {
+		(*list)->ks_prev = ks;
+	}
+	*list = ks;
+	ks->ks_list = list;
+}
+
+static
+void
+slab_remove(struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(*ks->ks_list == ks);
+		*ks->ks_list = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_list = NULL;
+}
+
+static
+void
+slab_move(struct kmem_slab **list, struct kmem_slab *ks)
+{
+	if (ks->ks_list != list) {
+		slab_remove(ks);
+		slab_insert(list, ks);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Slab creation
+
+/*
+ * Make a new slab for KC, with all objects free and constructed. Does
+ * not touch the cache's lists, and is called without its lock, since
+ * alloc_kpages and the constructor shouldn't run under a spinlock.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	char *obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	KASSERT(page % PAGE_SIZE == 0);
+
+	ks = SLAB_OF(page);
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_list = NULL;
+	ks->ks_cache = kc;
+	ks->ks_free = NULL;
+	ks->ks_inuse = 0;
+
+	/* Build the free list backwards so it comes out in address order. */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		obj = (char *)page + i * kc->kc_stride;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(obj);
+		}
+		*OBJ_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+	}
+	return ks;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0 && size <= KMEM_MAXSIZE);
+	if (align == 0) {
+		align = KMEM_DEFALIGN;
+	}
+	KASSERT((align & (align - 1)) == 0);
+	if (align < sizeof(void *)) {
+		align = sizeof(void *);
+	}
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	if (ctor != NULL) {
+		kc->kc_linkoff = ROUNDUP(size, sizeof(void *));
+		kc->kc_stride = ROUNDUP(kc->kc_linkoff + sizeof(void *), align);
+	}
+	else {
+		kc->kc_linkoff = 0;
+		kc->kc_stride = ROUNDUP(size, align);
+	}
+	kc->kc_perslab = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		kc->kc_stride;
+	KASSERT(kc->kc_perslab > 0);
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_full = NULL;
+	kc->kc_empty = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+
+	spinlock_acquire(&allcaches_lock);
+	kc->kc_next = allcaches;
+	allcaches = kc;
+	spinlock_release(&allcaches_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *ks;
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_partial == NULL);
+	KASSERT(kc->kc_full == NULL);
+
+	spinlock_acquire(&allcaches_lock);
+	for (kcp = &allcaches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&allcaches_lock);
+
+	while ((ks = kc->kc_empty) != NULL) {
+		slab_remove(ks);
+		free_kpages(SLAB_PAGE(ks));
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	while (1) {
+		ks = kc->kc_partial;
+		if (ks == NULL) {
+			ks = kc->kc_empty;
+			if (ks != NULL) {
+				kc->kc_nempty--;
+			}
+		}
+		if (ks != NULL) {
+			break;
+		}
+
+		/*
+		 * Need a new slab. Make it without the lock; if
+		 * someone else added one in the meantime, that's
+		 * fine, we'll just have an extra empty slab.
+		 */
+		spinlock_release(&kc->kc_lock);
+		ks = slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		slab_insert(&kc->kc_empty, ks);
+		kc->kc_nslabs++;
+		kc->kc_nempty++;
+	}
+
+	obj = ks->ks_free;
+	KASSERT(obj != NULL);
+	ks->ks_free = *OBJ_LINK(kc, obj);
+	ks->ks_inuse++;
+	kc->kc_inuse++;
+	slab_move(ks->ks_free == NULL ? &kc->kc_full : &kc->kc_partial, ks);
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+
+	ks = SLAB_OF(obj);
+	offset = (vaddr_t)obj - SLAB_PAGE(ks);
+	if (ks->ks_cache != kc || offset % kc->kc_stride != 0 ||
+	    offset / kc->kc_stride >= kc->kc_perslab) {
+		panic("kmem_cache_free: %p is not from cache %s\n",
+		      obj, kc->kc_name);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(ks->ks_inuse > 0);
+	*OBJ_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+	ks->ks_inuse--;
+	kc->kc_inuse--;
+
+	if (ks->ks_inuse > 0) {
+		slab_move(&kc->kc_partial, ks);
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+
+	if (kc->kc_nempty < KMEM_MAXEMPTY) {
+		slab_move(&kc->kc_empty, ks);
+		kc->kc_nempty++;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+
+	slab_remove(ks);
+	kc->kc_nslabs--;
+	spinlock_release(&kc->kc_lock);
+	free_kpages(SLAB_PAGE(ks));
+}
+
+/*
+ * Print, for each cache, how many objects are in use and how much
+ * memory its slabs take, compared to what kmalloc would have used for
+ * the same objects. The difference can be negative when the cache is
+ * mostly empty slabs.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	size_t used, askmalloc;
+	long saved, totalsaved;
+
+	totalsaved = 0;
+
+	spinlock_acquire(&allcaches_lock);
+	kprintf("Object caches:\n");
+	kprintf("%-16s %5s %6s %6s %6s %8s %8s %8s\n",
+		"NAME", "SIZE", "STRIDE", "INUSE", "SLABS", "BYTES",
+		"KMALLOC", "SAVED");
+	for (kc = allcaches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		used = kc->kc_nslabs * PAGE_SIZE;
+		askmalloc = kc->kc_inuse * kmalloc_blocksize(kc->kc_size);
+		spinlock_release(&kc->kc_lock);
+		saved = (long)askmalloc - (long)used;
+		totalsaved += saved;
+		kprintf("%-16s %5lu %6lu %6u %6u %8lu %8lu %8ld\n",
+			kc->kc_name, (unsigned long)kc->kc_size,
+			(unsigned long)kc->kc_stride, kc->kc_inuse,
+			kc->kc_nslabs, (unsigned long)used,
+			(unsigned long)askmalloc, saved);
+	}
+	spinlock_release(&allcaches_lock);
+	kprintf("Total saved by object caches: %ld bytes\n", totalsaved);
+}
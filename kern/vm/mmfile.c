@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page cache for memory-mapped files. See mmfile.h.
+ *
+ * mmfile_lock protects the list of mapped files and their reference
+ * counts; each file's mf_lock protects its page array. The page
+ * array is indexed by page number in the file and grows as pages
+ * further into the file are touched. Each cached page holds one
+ * coremap reference for the cache itself, plus one per mapping that
+ * has it in its page table.
+ *
+ * Lock order: an address space lock, then mmfile_lock, then mf_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <mmfile.h>
+
+/* Smallest page array allocated. */
+#define MF_MINPAGES	16
+
+/* Low bit of a page array entry: written through a shared mapping. */
+#define MF_DIRTY	0x1
+
+/* Most pages mmfile_getpages reads in one go. */
+#define MF_MAXREAD	32
+
+struct mmfile {
+	struct vnode *mf_vn;
+	unsigned mf_refcount;		/* regions mapping the file */
+	struct lock *mf_lock;
+	paddr_t *mf_pages;		/* cached page, | MF_DIRTY, or 0 */
+	unsigned mf_npages;		/* size of mf_pages */
+	struct mmfile *mf_next;
+};
+
+static struct lock *mmfile_lock;
+static struct mmfile *mmfile_list;
+
+/*
+ * Read or write the N pages of the file VN from page INDEX on to or
+ * from the pages PAS, in one VOP_MMAP.
+ */
+static
+int
+mmfile_io(struct vnode *vn, const paddr_t *pas, unsigned n, unsigned index,
+	  enum uio_rw rw)
+{
+	struct iovec iov[MF_MAXREAD];
+	struct uio u;
+	unsigned i;
+
+	KASSERT(n > 0 && n <= MF_MAXREAD);
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pas[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = n;
+	u.uio_offset = (off_t)index * PAGE_SIZE;
+	u.uio_resid = n * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = rw;
+	u.uio_space = NULL;
+	return VOP_MMAP(vn, &u);
+}
+
+/*
+ * Make the page array big enough to hold page INDEX. The file must
+ * be locked.
+ */
+static
+int
+mmfile_grow(struct mmfile *mf, unsigned index)
+{
+	paddr_t *newpages;
+	unsigned newsize, i;
+
+	if (index < mf->mf_npages) {
+		return 0;
+	}
+
+	newsize = mf->mf_npages < MF_MINPAGES ? MF_MINPAGES : mf->mf_npages;
+	while (newsize <= index) {
+		newsize *= 2;
+	}
+	newpages = kmalloc(newsize * sizeof(paddr_t));
+	if (newpages == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<mf->mf_npages; i++) {
+		newpages[i] = mf->mf_pages[i];
+	}
+	for (; i<newsize; i++) {
+		newpages[i] = 0;
+	}
+	kfree(mf->mf_pages);
+	mf->mf_pages = newpages;
+	mf->mf_npages = newsize;
+	return 0;
+}
+
+void
+mmfile_bootstrap(void)
+{
+	mmfile_lock = lock_create("mmfile");
+	if (mmfile_lock == NULL) {
+		panic("mmfile_bootstrap: Out of memory\n");
+	}
+	mmfile_list = NULL;
+}
+
+int
+mmfile_get(struct vnode *vn, struct mmfile **ret)
+{
+	struct mmfile *mf;
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	lock_acquire(mmfile_lock);
+	for (mf = mmfile_list; mf != NULL; mf = mf->mf_next) {
+		if (mf->mf_vn == vn) {
+			mf->mf_refcount++;
+			lock_release(mmfile_lock);
+			*ret = mf;
+			return 0;
+		}
+	}
+
+	/* Not mapped yet. Ask the filesystem if it can be. */
+	uio_kinit(&iov, &u, NULL, 0, 0, UIO_READ);
+	result = VOP_MMAP(vn, &u);
+	if (result) {
+		lock_release(mmfile_lock);
+		return result;
+	}
+
+	mf = kmalloc(sizeof(*mf));
+	if (mf == NULL) {
+		lock_release(mmfile_lock);
+		return ENOMEM;
+	}
+	mf->mf_lock = lock_create("mmfile page cache");
+	if (mf->mf_lock == NULL) {
+		kfree(mf);
+		lock_release(mmfile_lock);
+		return ENOMEM;
+	}
+	VOP_INCREF(vn);
+	mf->mf_vn = vn;
+	mf->mf_refcount = 1;
+	mf->mf_pages = NULL;
+	mf->mf_npages = 0;
+	mf->mf_next = mmfile_list;
+	mmfile_list = mf;
+	lock_release(mmfile_lock);
+
+	*ret = mf;
+	return 0;
+}
+
+void
+mmfile_incref(struct mmfile *mf)
+{
+	lock_acquire(mmfile_lock);
+	KASSERT(mf->mf_refcount > 0);
+	mf->mf_refcount++;
+	lock_release(mmfile_lock);
+}
+
+void
+mmfile_release(struct mmfile *mf)
+{
+	struct mmfile **mfp;
+	paddr_t pa;
+	unsigned i;
+	int result;
+
+	lock_acquire(mmfile_lock);
+	KASSERT(mf->mf_refcount > 0);
+	mf->mf_refcount--;
+	if (mf->mf_refcount > 0) {
+		lock_release(mmfile_lock);
+		return;
+	}
+
+	/*
+	 * Write back while still on the list, so that mapping the
+	 * file again in the meantime can't read old data from disk.
+	 * There's nobody to report a failure to but the console.
+	 */
+	for (i=0; i<mf->mf_npages; i++) {
+		pa = mf->mf_pages[i] & PAGE_FRAME;
+		if (pa == 0) {
+			continue;
+		}
+		if (mf->mf_pages[i] & MF_DIRTY) {
+			result = mmfile_io(mf->mf_vn, &pa, 1, i, UIO_WRITE);
+			if (result) {
+				kprintf("mmap: Writing back page %u: %s\n",
+					i, strerror(result));
+			}
+		}
+		coremap_free(pa);
+	}
+
+	for (mfp = &mmfile_list; *mfp != mf; mfp = &(*mfp)->mf_next) {
+		KASSERT(*mfp != NULL);
+	}
+	*mfp = mf->mf_next;
+	lock_release(mmfile_lock);
+
+	VOP_DECREF(mf->mf_vn);
+	kfree(mf->mf_pages);
+	lock_destroy(mf->mf_lock);
+	kfree(mf);
+}
+
+int
+mmfile_getpage(struct mmfile *mf, unsigned index, paddr_t *ret)
+{
+	unsigned got;
+
+	return mmfile_getpages(mf, index, 1, ret, &got);
+}
+
+int
+mmfile_getpages(struct mmfile *mf, unsigned index, unsigned npages,
+		paddr_t *pas, unsigned *got)
+{
+	unsigned i, j, n;
+	bool short_run;
+	int result;
+
+	KASSERT(npages > 0);
+	if (npages > MF_MAXREAD) {
+		npages = MF_MAXREAD;
+	}
+
+	lock_acquire(mf->mf_lock);
+	result = mmfile_grow(mf, index + npages - 1);
+	if (result) {
+		lock_release(mf->mf_lock);
+		return result;
+	}
+
+	for (i=0; i<npages; i += n) {
+		pas[i] = mf->mf_pages[index + i] & PAGE_FRAME;
+		if (pas[i] != 0) {
+			n = 1;
+			continue;
+		}
+
+		/* A run of pages not cached yet: read them together. */
+		short_run = false;
+		for (n=0; i + n < npages &&
+			     mf->mf_pages[index + i + n] == 0; n++) {
+			pas[i + n] = coremap_alloc(1);
+			if (pas[i + n] == 0) {
+				short_run = true;
+				break;
+			}
+		}
+		if (n == 0) {
+			result = ENOMEM;
+			break;
+		}
+		result = mmfile_io(mf->mf_vn, &pas[i], n, index + i,
+				   UIO_READ);
+		if (result) {
+			for (j=0; j<n; j++) {
+				coremap_free(pas[i + j]);
+			}
+			break;
+		}
+		for (j=0; j<n; j++) {
+			mf->mf_pages[index + i + j] = pas[i + j];
+		}
+		if (short_run) {
+			i += n;
+			break;
+		}
+	}
+
+	for (j=0; j<i; j++) {
+		coremap_share(pas[j]);
+	}
+	lock_release(mf->mf_lock);
+
+	*got = i;
+	return i > 0 ? 0 : result;
+}
+
+void
+mmfile_setdirty(struct mmfile *mf, unsigned index)
+{
+	lock_acquire(mf->mf_lock);
+	KASSERT(index < mf->mf_npages && mf->mf_pages[index] != 0);
+	mf->mf_pages[index] |= MF_DIRTY;
+	lock_release(mf->mf_lock);
+}
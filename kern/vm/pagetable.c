@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Two-level page tables. See pagetable.h.
+ *
+ * The directory and the second-level pages come from kmalloc; a
+ * second-level page is exactly one page, so it is handed out whole.
+ * The tables have no lock of their own; the address space's lock
+ * covers them.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i=0; i<PT_NDIR; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *ptes;
+	unsigned d;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	d = PT_DIRINDEX(vaddr);
+	ptes = pt->pt_dir[d];
+	if (ptes == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		ptes = kmalloc(PT_NPTE * sizeof(pte_t));
+		if (ptes == NULL) {
+			return NULL;
+		}
+		bzero(ptes, PT_NPTE * sizeof(pte_t));
+		pt->pt_dir[d] = ptes;
+	}
+	return &ptes[PT_PTEINDEX(vaddr)];
+}
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Paging: choosing user pages to evict, and bringing them back.
+ *
+ * When coremap_alloc runs out of memory it calls vm_pageout. If the
+ * swap read-ahead cache is holding pages, those are given back
+ * first, since nothing maps them. Otherwise vm_pageout runs the
+ * coremap's clock (coremap_victim) over the pageable user pages. Each page gets a second chance: if its PTE_REF bit is set
+ * (it has been loaded into a TLB since the hand last came by) the
+ * bit is cleared and the page skipped. Up to SWAP_CLUSTER victims
+ * are collected per call.
+ *
+ * A victim's address space has to be locked while its PTE is
+ * changed. The thread calling vm_pageout usually already holds its
+ * own address space's lock (it's in vm_fault), and its pages are
+ * fair game like anyone else's: whoever holds that lock is between
+ * PTE updates whenever it can allocate memory. Other owners are only
+ * ever locked with lock_tryacquire, since waiting for them could
+ * deadlock; an address space that's busy is simply passed over.
+ *
+ * Victims are then shot down from every TLB that might have them in
+ * one batch. Clean ones (still zero, or with a good copy in swap)
+ * are freed right away. Dirty ones are sorted by address space and
+ * address, given consecutive swap slots, and written out together,
+ * so they cost one disk write per cluster rather than per page and
+ * come back in order when read ahead.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <vm.h>
+#include <swap.h>
+
+/*
+ * Most pages the clock looks at in one vm_pageout. coremap_victim
+ * takes only a few steps at a time, so interrupts are never off for
+ * long while it scans.
+ */
+#define PAGING_MAXSCAN	4096
+
+/* Most address spaces locked at once in one vm_pageout. */
+#define PAGING_MAXAS	(SWAP_CLUSTER + 1)
+
+struct pagingvictim {
+	struct addrspace *pv_as;
+	vaddr_t pv_vaddr;
+	paddr_t pv_pa;
+	pte_t *pv_pte;
+};
+
+struct pagingstate {
+	struct addrspace *ps_held[PAGING_MAXAS];
+	unsigned ps_nheld;
+};
+
+static bool paging_ready;
+
+/* Counters, protected by paging_lock. */
+static struct spinlock paging_lock = SPINLOCK_INITIALIZER;
+static unsigned paging_pageouts;	/* pages paged out */
+static unsigned paging_dirtyouts;	/* ...of which written to swap */
+static unsigned paging_pageins;		/* pages brought back in */
+static unsigned paging_scans;		/* pages the clock looked at */
+static unsigned paging_failures;	/* vm_pageouts that freed nothing */
+static unsigned paging_cachefrees;	/* swap cache pages given back */
+
+/* For vm_printstats rates. */
+static uint64_t paging_lasttime;
+static unsigned paging_lastouts, paging_lastins;
+
+/*
+ * coremap_victim callback: accept pages of address spaces already
+ * locked by this thread, or ones that can be locked now. Only the
+ * ones locked here go in ps_held, to be unlocked again at the end.
+ */
+static
+bool
+paging_claim(struct addrspace *as, void *data)
+{
+	struct pagingstate *ps = data;
+	unsigned i;
+
+	if (lock_do_i_hold(as->as_lock)) {
+		return true;
+	}
+	for (i=0; i<ps->ps_nheld; i++) {
+		if (ps->ps_held[i] == as) {
+			return true;
+		}
+	}
+	if (ps->ps_nheld == PAGING_MAXAS || !lock_tryacquire(as->as_lock)) {
+		return false;
+	}
+	ps->ps_held[ps->ps_nheld++] = as;
+	return true;
+}
+
+/*
+ * Sort victims by address space and then address.
+ */
+static
+void
+paging_sort(struct pagingvictim *v, unsigned n)
+{
+	struct pagingvictim tmp;
+	unsigned i, j;
+
+	for (i=1; i<n; i++) {
+		tmp = v[i];
+		for (j=i; j>0; j--) {
+			if (v[j-1].pv_as < tmp.pv_as ||
+			    (v[j-1].pv_as == tmp.pv_as &&
+			     v[j-1].pv_vaddr < tmp.pv_vaddr)) {
+				break;
+			}
+			v[j] = v[j-1];
+		}
+		v[j] = tmp;
+	}
+}
+
+/*
+ * Write out the N dirty victims V, in as few I/Os as swap allows.
+ * Each one written is turned into a swapped PTE and freed; the rest
+ * are left resident. Returns the number written.
+ */
+static
+unsigned
+paging_writeout(struct pagingvictim *v, unsigned n)
+{
+	paddr_t pas[SWAP_CLUSTER];
+	unsigned done, got, slot, i;
+	pte_t pte;
+
+	done = 0;
+	while (done < n) {
+		got = swap_alloc(n - done, &slot);
+		if (got == 0) {
+			break;
+		}
+		for (i=0; i<got; i++) {
+			pas[i] = v[done + i].pv_pa;
+		}
+		if (swap_write(pas, got, slot)) {
+			for (i=0; i<got; i++) {
+				swap_free(slot + i);
+			}
+			break;
+		}
+		for (i=0; i<got; i++) {
+			pte = *v[done + i].pv_pte;
+			*v[done + i].pv_pte = PTE_MKSWAP(slot + i) |
+				(pte & PTE_WRITE);
+			coremap_free(v[done + i].pv_pa);
+		}
+		done += got;
+	}
+
+	for (i=done; i<n; i++) {
+		coremap_unbusy(v[i].pv_pa);
+	}
+	return done;
+}
+
+int
+vm_pageout(void)
+{
+	struct pagingstate ps;
+	struct pagingvictim v[SWAP_CLUSTER];
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	struct addrspace *as;
+	cpuset_t targets;
+	unsigned nv, nts, ndirty, nclean, scanned, before, slot, i;
+	vaddr_t vaddr;
+	paddr_t pa;
+	pte_t *pte;
+
+	if (!paging_ready || curthread->t_in_interrupt ||
+	    curthread->t_iplhigh_count > 0 || curcpu->c_spinlocks > 0) {
+		return 0;
+	}
+
+	/* Pages only the read-ahead cache wants go first. */
+	nclean = swap_reclaim();
+	if (nclean > 0) {
+		spinlock_acquire(&paging_lock);
+		paging_cachefrees += nclean;
+		spinlock_release(&paging_lock);
+		return nclean;
+	}
+
+	ps.ps_nheld = 0;
+	nv = nts = 0;
+	targets = 0;
+	scanned = 0;
+	while (nv < SWAP_CLUSTER && scanned < PAGING_MAXSCAN) {
+		before = scanned;
+		pa = coremap_victim(paging_claim, &ps, &scanned, &as, &vaddr);
+		if (pa == 0) {
+			if (scanned == before) {
+				break;
+			}
+			continue;
+		}
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		KASSERT(pte != NULL);
+		KASSERT((*pte & (PTE_VALID | PTE_FRAME)) == (PTE_VALID | pa));
+
+		if (*pte & PTE_REF) {
+			/*
+			 * Second chance. Drop any TLB entries too, so
+			 * the next use refaults and sets PTE_REF again.
+			 */
+			*pte &= ~(pte_t)PTE_REF;
+			coremap_unbusy(pa);
+			if (nts < TLBSHOOTDOWN_MAX) {
+				ts[nts].ts_as = as;
+				ts[nts].ts_vaddr = vaddr;
+				nts++;
+				targets |= as->as_cpus;
+			}
+			continue;
+		}
+
+		v[nv].pv_as = as;
+		v[nv].pv_vaddr = vaddr;
+		v[nv].pv_pa = pa;
+		v[nv].pv_pte = pte;
+		nv++;
+		if (nts < TLBSHOOTDOWN_MAX) {
+			ts[nts].ts_as = as;
+			ts[nts].ts_vaddr = vaddr;
+		}
+		/* Past TLBSHOOTDOWN_MAX the targets flush everything. */
+		nts++;
+		targets |= as->as_cpus;
+	}
+
+	if (nts > 0) {
+		ipi_tlbshootdown_batch(targets, ts, nts);
+	}
+
+	/* Free the clean ones; gather the dirty ones at the front. */
+	ndirty = nclean = 0;
+	for (i=0; i<nv; i++) {
+		if (*v[i].pv_pte & PTE_DIRTY) {
+			v[ndirty++] = v[i];
+			continue;
+		}
+		slot = coremap_takeslot(v[i].pv_pa);
+		if (slot == SWAP_NOSLOT) {
+			/* Never written: still all zeros. */
+			*v[i].pv_pte = 0;
+		}
+		else {
+			*v[i].pv_pte = PTE_MKSWAP(slot) |
+				(*v[i].pv_pte & PTE_WRITE);
+		}
+		coremap_free(v[i].pv_pa);
+		nclean++;
+	}
+
+	paging_sort(v, ndirty);
+	ndirty = paging_writeout(v, ndirty);
+
+	for (i=0; i<ps.ps_nheld; i++) {
+		lock_release(ps.ps_held[i]->as_lock);
+	}
+
+	spinlock_acquire(&paging_lock);
+	paging_pageouts += nclean + ndirty;
+	paging_dirtyouts += ndirty;
+	paging_scans += scanned;
+	if (nclean + ndirty == 0) {
+		paging_failures++;
+	}
+	spinlock_release(&paging_lock);
+
+	return nclean + ndirty;
+}
+
+int
+vm_pagein(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	unsigned slot;
+	paddr_t pa;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(*pte & PTE_SWAPPED);
+
+	slot = PTE_SWAPSLOT(*pte);
+	pa = swap_takecached(slot);
+	if (pa == 0) {
+		pa = coremap_alloc(1);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		result = swap_read(pa, slot);
+		if (result) {
+			coremap_free(pa);
+			return result;
+		}
+	}
+	swap_prefetch(slot);
+
+	/* Resident again, and clean: the slot still matches it. */
+	*pte = pa | PTE_VALID | (*pte & PTE_WRITE);
+	coremap_setslot(pa, slot);
+	coremap_setowner(pa, as, vaddr);
+
+	spinlock_acquire(&paging_lock);
+	paging_pageins++;
+	spinlock_release(&paging_lock);
+	return 0;
+}
+
+void
+vm_pagedirty(pte_t *pte)
+{
+	unsigned slot;
+
+	KASSERT(*pte & PTE_VALID);
+
+	*pte |= PTE_DIRTY;
+	slot = coremap_takeslot(*pte & PTE_FRAME);
+	if (slot != SWAP_NOSLOT) {
+		swap_free(slot);
+	}
+}
+
+void
+paging_bootstrap(void)
+{
+	paging_lasttime = gettime_ns();
+	paging_ready = true;
+}
+
+void
+vm_printstats(void)
+{
+	unsigned outs, dirtyouts, ins, scans, failures, cachefrees;
+	unsigned lastouts, lastins;
+	uint64_t now, ms;
+
+	now = gettime_ns();
+
+	spinlock_acquire(&paging_lock);
+	outs = paging_pageouts;
+	dirtyouts = paging_dirtyouts;
+	ins = paging_pageins;
+	scans = paging_scans;
+	failures = paging_failures;
+	cachefrees = paging_cachefrees;
+	lastouts = paging_lastouts;
+	lastins = paging_lastins;
+	ms = (now - paging_lasttime) / 1000000;
+	paging_lastouts = outs;
+	paging_lastins = ins;
+	paging_lasttime = now;
+	spinlock_release(&paging_lock);
+
+	coremap_printstats();
+	kprintf("Paging: %u pages out (%u written), %u pages in\n",
+		outs, dirtyouts, ins);
+	kprintf("Clock: %u pages scanned, %u pageouts found nothing\n",
+		scans, failures);
+	kprintf("Swap cache pages reclaimed: %u\n", cachefrees);
+	if (ms > 0) {
+		kprintf("Since last vmstat (%llu ms): %llu pages/s out, "
+			"%llu pages/s in\n", (unsigned long long)ms,
+			(unsigned long long)(outs - lastouts) * 1000 / ms,
+			(unsigned long long)(ins - lastins) * 1000 / ms);
+	}
+	vm_printfaultstats();
+	swap_printstats();
+}
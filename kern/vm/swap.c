@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap space.
+ *
+ * Slots are tracked with a bitmap. swap_alloc hands out runs of
+ * consecutive slots, starting from where the last run ended, so a
+ * cluster of pages being paged out together goes to disk in one
+ * write and, since the pageout code sorts each cluster by address
+ * space and address, neighbouring pages usually land in neighbouring
+ * slots.
+ *
+ * That is what the read-ahead counts on: when a page is read back in,
+ * the next SWAP_PREFETCH slots are queued for the prefetch thread,
+ * which reads them into spare pages kept in a small cache. A fault on
+ * one of those then just takes the page. Prefetching is skipped when
+ * free memory is low, so it never causes pageouts itself.
+ *
+ * The cache's pages are the first thing given back when memory runs
+ * out (swap_reclaim, called from vm_pageout); a page read ahead is
+ * only a guess, and cheaper to lose than one somebody has mapped.
+ *
+ * Slot contents only change when a slot is allocated and written, so
+ * a cached copy stays good until its slot is freed; swap_free drops
+ * it (or, if the read is still going on, marks it to be dropped when
+ * it finishes).
+ *
+ * swap_lock protects everything here except the I/O itself. It is
+ * taken before coremap_lock, never after.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+
+/* Slots read ahead after each page-in. */
+#define SWAP_PREFETCH		4
+
+/* Pages the read-ahead cache holds. */
+#define SWAPCACHE_SIZE		16
+
+/* Slots that can be waiting to be prefetched. */
+#define SWAP_PFQUEUE		16
+
+/* Don't prefetch unless at least this many pages are free. */
+#define SWAP_PREFETCH_MINFREE	32
+
+/* Read-ahead cache entry states. */
+#define SC_EMPTY	0
+#define SC_LOADING	1	/* prefetch thread is reading it */
+#define SC_READY	2
+#define SC_STALE	3	/* slot freed while loading; drop it */
+
+struct swapcache {
+	unsigned sc_state;
+	unsigned sc_slot;
+	paddr_t sc_pa;
+};
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static struct vnode *swap_vnode;	/* NULL if no swap */
+static struct bitmap *swap_map;
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static unsigned swap_rotor;		/* where swap_alloc looks first */
+
+static struct swapcache swap_cache[SWAPCACHE_SIZE];
+static unsigned swap_cachehand;		/* next READY entry to replace */
+
+static unsigned swap_pfqueue[SWAP_PFQUEUE];
+static unsigned swap_pfhead, swap_pfcount;
+static struct wchan *swap_pfwchan;
+
+/* Counters. */
+static unsigned swap_reads;		/* pages read on demand */
+static unsigned swap_writes;		/* pages written */
+static unsigned swap_writeios;		/* write I/Os (clusters) */
+static unsigned swap_pfreads;		/* pages read ahead */
+static unsigned swap_pfhits;		/* ...that were then used */
+static unsigned swap_pfdrops;		/* ...that weren't */
+
+/*
+ * Move N pages between memory and consecutive slots from SLOT.
+ */
+static
+int
+swap_io(const paddr_t *pas, unsigned n, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio u;
+	unsigned i;
+	int result;
+
+	KASSERT(n > 0 && n <= SWAP_CLUSTER);
+	KASSERT(slot + n <= swap_nslots);
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pas[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = n;
+	u.uio_offset = (off_t)slot * PAGE_SIZE;
+	u.uio_resid = n * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = rw;
+	u.uio_space = NULL;
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &u);
+	}
+	if (result == 0 && u.uio_resid > 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+unsigned
+swap_alloc(unsigned n, unsigned *slot)
+{
+	unsigned i, start, got;
+
+	KASSERT(n > 0);
+
+	spinlock_acquire(&swap_lock);
+	if (swap_vnode == NULL || swap_nused == swap_nslots) {
+		spinlock_release(&swap_lock);
+		return 0;
+	}
+
+	/* Find a free slot, going around from the rotor. */
+	start = swap_rotor;
+	for (i=0; i<swap_nslots; i++) {
+		if (!bitmap_isset(swap_map, start)) {
+			break;
+		}
+		start = (start + 1) % swap_nslots;
+	}
+	KASSERT(i < swap_nslots);
+
+	/* Take as many more after it as are free, up to N. */
+	for (got = 0; got < n && start + got < swap_nslots; got++) {
+		if (bitmap_isset(swap_map, start + got)) {
+			break;
+		}
+		bitmap_mark(swap_map, start + got);
+	}
+	swap_nused += got;
+	swap_rotor = (start + got) % swap_nslots;
+	spinlock_release(&swap_lock);
+
+	*slot = start;
+	return got;
+}
+
+void
+swap_free(unsigned slot)
+{
+	struct swapcache *sc;
+	paddr_t pa = 0;
+	unsigned i;
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(slot < swap_nslots);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		sc = &swap_cache[i];
+		if (sc->sc_slot != slot) {
+			continue;
+		}
+		if (sc->sc_state == SC_READY) {
+			pa = sc->sc_pa;
+			sc->sc_state = SC_EMPTY;
+			swap_pfdrops++;
+		}
+		else if (sc->sc_state == SC_LOADING) {
+			sc->sc_state = SC_STALE;
+		}
+	}
+	spinlock_release(&swap_lock);
+
+	if (pa != 0) {
+		coremap_free(pa);
+	}
+}
+
+int
+swap_write(const paddr_t *pas, unsigned n, unsigned slot)
+{
+	int result;
+
+	result = swap_io(pas, n, slot, UIO_WRITE);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_writes += n;
+		swap_writeios++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+int
+swap_read(paddr_t pa, unsigned slot)
+{
+	int result;
+
+	result = swap_io(&pa, 1, slot, UIO_READ);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_reads++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+paddr_t
+swap_takecached(unsigned slot)
+{
+	struct swapcache *sc;
+	paddr_t pa = 0;
+	unsigned i;
+
+	spinlock_acquire(&swap_lock);
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		sc = &swap_cache[i];
+		if (sc->sc_slot != slot) {
+			continue;
+		}
+		if (sc->sc_state == SC_READY) {
+			pa = sc->sc_pa;
+			sc->sc_state = SC_EMPTY;
+			swap_pfhits++;
+		}
+		else if (sc->sc_state == SC_LOADING) {
+			/* Caller will read it; don't keep a second copy. */
+			sc->sc_state = SC_STALE;
+		}
+	}
+	spinlock_release(&swap_lock);
+	return pa;
+}
+
+/*
+ * Check if SLOT is cached or being read ahead. Swap must be locked.
+ */
+static
+bool
+swap_iscached(unsigned slot)
+{
+	unsigned i;
+
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		if (swap_cache[i].sc_slot == slot &&
+		    (swap_cache[i].sc_state == SC_READY ||
+		     swap_cache[i].sc_state == SC_LOADING)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+swap_prefetch(unsigned slot)
+{
+	unsigned i, s;
+
+	spinlock_acquire(&swap_lock);
+	if (swap_pfwchan == NULL) {
+		spinlock_release(&swap_lock);
+		return;
+	}
+	for (i=1; i<=SWAP_PREFETCH && swap_pfcount < SWAP_PFQUEUE; i++) {
+		s = slot + i;
+		if (s >= swap_nslots || !bitmap_isset(swap_map, s)) {
+			break;
+		}
+		if (swap_iscached(s)) {
+			continue;
+		}
+		swap_pfqueue[(swap_pfhead + swap_pfcount) % SWAP_PFQUEUE] = s;
+		swap_pfcount++;
+	}
+	if (swap_pfcount > 0) {
+		wchan_wakeone(swap_pfwchan, &swap_lock);
+	}
+	spinlock_release(&swap_lock);
+}
+
+unsigned
+swap_reclaim(void)
+{
+	paddr_t pas[SWAPCACHE_SIZE];
+	unsigned i, n;
+
+	n = 0;
+	spinlock_acquire(&swap_lock);
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		if (swap_cache[i].sc_state == SC_READY) {
+			pas[n++] = swap_cache[i].sc_pa;
+			swap_cache[i].sc_state = SC_EMPTY;
+			swap_pfdrops++;
+		}
+	}
+	spinlock_release(&swap_lock);
+
+	for (i=0; i<n; i++) {
+		coremap_free(pas[i]);
+	}
+	return n;
+}
+
+/*
+ * Find a cache entry to read into: an empty one if possible, else
+ * the next ready one around the hand, whose page is handed back in
+ * *OLDPA for the caller to free. Returns NULL if every entry is
+ * busy. Swap must be locked.
+ */
+static
+struct swapcache *
+swap_cacheslot(paddr_t *oldpa)
+{
+	struct swapcache *sc;
+	unsigned i;
+
+	*oldpa = 0;
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		if (swap_cache[i].sc_state == SC_EMPTY) {
+			return &swap_cache[i];
+		}
+	}
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		sc = &swap_cache[swap_cachehand];
+		swap_cachehand = (swap_cachehand + 1) % SWAPCACHE_SIZE;
+		if (sc->sc_state == SC_READY) {
+			*oldpa = sc->sc_pa;
+			sc->sc_state = SC_EMPTY;
+			swap_pfdrops++;
+			return sc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The prefetch thread: read queued slots into the cache.
+ */
+static
+void
+swap_prefetch_thread(void *junk1, unsigned long junk2)
+{
+	struct swapcache *sc;
+	paddr_t pa, oldpa;
+	unsigned slot;
+	int result;
+
+	(void)junk1;
+	(void)junk2;
+
+	spinlock_acquire(&swap_lock);
+	while (1) {
+		if (swap_pfcount == 0) {
+			wchan_sleep(swap_pfwchan, &swap_lock);
+			continue;
+		}
+		slot = swap_pfqueue[swap_pfhead];
+		swap_pfhead = (swap_pfhead + 1) % SWAP_PFQUEUE;
+		swap_pfcount--;
+
+		if (!bitmap_isset(swap_map, slot) || swap_iscached(slot)) {
+			continue;
+		}
+		sc = swap_cacheslot(&oldpa);
+		if (sc == NULL) {
+			continue;
+		}
+		sc->sc_state = SC_LOADING;
+		sc->sc_slot = slot;
+		spinlock_release(&swap_lock);
+
+		if (oldpa != 0) {
+			coremap_free(oldpa);
+		}
+		pa = 0;
+		if (coremap_freepages() >= SWAP_PREFETCH_MINFREE) {
+			pa = coremap_alloc(1);
+		}
+		result = (pa == 0) ? ENOMEM : swap_io(&pa, 1, slot, UIO_READ);
+
+		spinlock_acquire(&swap_lock);
+		if (result == 0 && sc->sc_state == SC_LOADING) {
+			sc->sc_state = SC_READY;
+			sc->sc_pa = pa;
+			swap_pfreads++;
+			pa = 0;
+		}
+		else {
+			if (result == 0) {
+				swap_pfdrops++;
+			}
+			sc->sc_state = SC_EMPTY;
+		}
+		if (pa != 0) {
+			spinlock_release(&swap_lock);
+			coremap_free(pa);
+			spinlock_acquire(&swap_lock);
+		}
+	}
+}
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct vnode *vn;
+	struct stat st;
+	struct bitmap *map;
+	struct wchan *wc;
+	unsigned i, nslots;
+	int result;
+
+	for (i=0; i<SWAPCACHE_SIZE; i++) {
+		swap_cache[i].sc_state = SC_EMPTY;
+		swap_cache[i].sc_slot = SWAP_NOSLOT;
+	}
+
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &vn);
+	if (result) {
+		kprintf("swap: %s: %s; paging out clean pages only\n",
+			SWAP_DEVICE, strerror(result));
+		return;
+	}
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		kprintf("swap: %s: stat: %s\n", SWAP_DEVICE, strerror(result));
+		vfs_close(vn);
+		return;
+	}
+	nslots = st.st_size / PAGE_SIZE;
+	if (nslots == 0) {
+		kprintf("swap: %s: too small\n", SWAP_DEVICE);
+		vfs_close(vn);
+		return;
+	}
+
+	map = bitmap_create(nslots);
+	wc = wchan_create("swapprefetch");
+	if (map == NULL || wc == NULL) {
+		panic("swap: Out of memory\n");
+	}
+
+	spinlock_acquire(&swap_lock);
+	swap_map = map;
+	swap_nslots = nslots;
+	swap_nused = 0;
+	swap_rotor = 0;
+	swap_pfwchan = wc;
+	swap_vnode = vn;
+	spinlock_release(&swap_lock);
+
+	result = thread_fork("swapprefetch", NULL, swap_prefetch_thread,
+			     NULL, 0);
+	if (result) {
+		panic("swap: Could not start prefetch thread: %s\n",
+		      strerror(result));
+	}
+
+	kprintf("swap: %s, %u pages\n", SWAP_DEVICE, nslots);
+}
+
+void
+swap_printstats(void)
+{
+	unsigned nslots, nused, reads, writes, writeios;
+	unsigned pfreads, pfhits, pfdrops;
+
+	spinlock_acquire(&swap_lock);
+	nslots = swap_nslots;
+	nused = swap_nused;
+	reads = swap_reads;
+	writes = swap_writes;
+	writeios = swap_writeios;
+	pfreads = swap_pfreads;
+	pfhits = swap_pfhits;
+	pfdrops = swap_pfdrops;
+	spinlock_release(&swap_lock);
+
+	if (nslots == 0) {
+		kprintf("Swap: none\n");
+		return;
+	}
+	kprintf("Swap: %u pages, %u in use\n", nslots, nused);
+	kprintf("Swap I/O: %u pages read, %u pages written in %u writes\n",
+		reads, writes, writeios);
+	kprintf("Swap read-ahead: %u pages, %u used, %u dropped\n",
+		pfreads, pfhits, pfdrops);
+}
@@ -41,6 +41,23 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Streams. The contents of FILE are private to libc.
+ */
+typedef struct __file FILE;
+
+extern FILE *stdin;	/* fully buffered */
+extern FILE *stdout;	/* line buffered */
+extern FILE *stderr;	/* unbuffered */
+
+/* Default buffer size */
+#define BUFSIZ 1024
+
+/* Buffering modes for setvbuf */
+#define _IOFBF 0	/* fully buffered */
+#define _IOLBF 1	/* line buffered */
+#define _IONBF 2	/* unbuffered */
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -50,9 +67,43 @@ int __vprintf(void (*sendfunc)(void *clientdata, const char *, size_t len),
 	      const char *fmt,
 	      __va_list ap);
 
+/*
+ * Flush every open stream; called by exit(), fork(), and execv().
+ * (for libc internal use only)
+ */
+void __stdio_flushall(void);
+
+/* Opening and closing streams */
+FILE *fopen(const char *path, const char *mode);
+FILE *fdopen(int fd, const char *mode);
+int fclose(FILE *f);
+
+/* Buffer control. setvbuf may only be used before any I/O is done. */
+int fflush(FILE *f);		/* f == NULL means all streams */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+
+/* Block I/O */
+size_t fread(void *ptr, size_t size, size_t nitems, FILE *f);
+size_t fwrite(const void *ptr, size_t size, size_t nitems, FILE *f);
+
+/* Character and string I/O */
+int fgetc(FILE *f);
+int getc(FILE *f);
+int fputc(int ch, FILE *f);
+int putc(int ch, FILE *f);
+int fputs(const char *s, FILE *f);
+
+/* Stream state */
+int feof(FILE *f);
+int ferror(FILE *f);
+void clearerr(FILE *f);
+int fileno(FILE *f);
+
 /* Printf calls for user programs */
 int printf(const char *fmt, ...);
 int vprintf(const char *fmt, __va_list ap);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
 int snprintf(char *buf, size_t len, const char *fmt, ...);
 int vsnprintf(char *buf, size_t len, const char *fmt, __va_list ap);
 
@@ -39,6 +39,7 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
@@ -147,6 +148,9 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
@@ -154,6 +158,8 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+pid_t __fork(void);
+int __execv(const char *prog, char *const *args);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -163,6 +169,7 @@ ssize_t __getcwd(char *buf, size_t buflen);
 
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
+/* fork and execv (above) are wrappers too, around __fork and __execv */
 time_t time(time_t *seconds);			/* calls __time */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "__stdio.h"
+
+/*
+ * Core of the stdio stream layer: the standard streams, the list of
+ * open streams, and buffer management shared by the stream functions.
+ */
+
+/*
+ * The standard streams, and their buffers, are static so that
+ * printf works without malloc. stderr is unbuffered, but gets a
+ * one-byte buffer anyway so the code never has to special-case a
+ * missing one.
+ */
+static char __stdinbuf[BUFSIZ];
+static char __stdoutbuf[BUFSIZ];
+static char __stderrbuf[1];
+
+static struct __file __stderr = {
+	STDERR_FILENO, __SWR | __SSTATIC, _IONBF,
+	__stderrbuf, sizeof(__stderrbuf), 0, 0, NULL
+};
+static struct __file __stdout = {
+	STDOUT_FILENO, __SWR | __SSTATIC, _IOLBF,
+	__stdoutbuf, sizeof(__stdoutbuf), 0, 0, &__stderr
+};
+static struct __file __stdin = {
+	STDIN_FILENO, __SRD | __SSTATIC, _IOFBF,
+	__stdinbuf, sizeof(__stdinbuf), 0, 0, &__stdout
+};
+
+FILE *stdin = &__stdin;
+FILE *stdout = &__stdout;
+FILE *stderr = &__stderr;
+
+/* All open streams. */
+static struct __file *__stdio_streams = &__stdin;
+
+void
+__stdio_link(FILE *f)
+{
+	f->f_next = __stdio_streams;
+	__stdio_streams = f;
+}
+
+void
+__stdio_unlink(FILE *f)
+{
+	struct __file **pp;
+
+	for (pp = &__stdio_streams; *pp != NULL; pp = &(*pp)->f_next) {
+		if (*pp == f) {
+			*pp = f->f_next;
+			f->f_next = NULL;
+			return;
+		}
+	}
+}
+
+/*
+ * Flush every open stream. Called by exit() and before fork() and
+ * execv(), so output still sitting in a buffer is neither lost nor
+ * duplicated in a child process.
+ */
+void
+__stdio_flushall(void)
+{
+	struct __file *f;
+
+	for (f = __stdio_streams; f != NULL; f = f->f_next) {
+		if (f->f_flags & __SWRITING) {
+			__stdio_wflush(f);
+		}
+	}
+}
+
+/*
+ * Allocate a buffer for a stream that doesn't have one yet.
+ */
+int
+__stdio_setbuf(FILE *f)
+{
+	size_t size;
+
+	if (f->f_buf != NULL) {
+		return 0;
+	}
+	size = (f->f_mode == _IONBF) ? 1 : BUFSIZ;
+	f->f_buf = malloc(size);
+	if (f->f_buf == NULL) {
+		f->f_flags |= __SERR;
+		return EOF;
+	}
+	f->f_bufsize = size;
+	f->f_flags |= __SMYBUF;
+	return 0;
+}
+
+/*
+ * Write LEN bytes straight to the file, retrying short writes.
+ */
+static
+int
+__stdio_writeall(FILE *f, const char *data, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_flags |= __SERR;
+			return EOF;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+int
+__stdio_wflush(FILE *f)
+{
+	int result;
+
+	if ((f->f_flags & __SWRITING) == 0) {
+		return 0;
+	}
+	result = __stdio_writeall(f, f->f_buf, f->f_len);
+	f->f_len = 0;
+	f->f_flags &= ~__SWRITING;
+	return result;
+}
+
+void
+__stdio_rdiscard(FILE *f)
+{
+	if ((f->f_flags & __SREADING) == 0) {
+		return;
+	}
+	if (f->f_len > f->f_pos) {
+		/* Ignore failure; the file may not be seekable. */
+		lseek(f->f_fd, -(off_t)(f->f_len - f->f_pos), SEEK_CUR);
+	}
+	f->f_pos = f->f_len = 0;
+	f->f_flags &= ~__SREADING;
+}
+
+/*
+ * Before blocking for input, push out pending output on line-buffered
+ * streams, so a prompt printed without a newline shows up before we
+ * wait for the user to answer it.
+ */
+static
+void
+__stdio_flushlinebuf(void)
+{
+	struct __file *f;
+
+	for (f = __stdio_streams; f != NULL; f = f->f_next) {
+		if (f->f_mode == _IOLBF && (f->f_flags & __SWRITING)) {
+			__stdio_wflush(f);
+		}
+	}
+}
+
+int
+__stdio_fill(FILE *f)
+{
+	ssize_t r;
+
+	if ((f->f_flags & __SRD) == 0) {
+		f->f_flags |= __SERR;
+		errno = EBADF;
+		return EOF;
+	}
+	if (f->f_flags & __SWRITING) {
+		if (__stdio_wflush(f)) {
+			return EOF;
+		}
+	}
+	if (__stdio_setbuf(f)) {
+		return EOF;
+	}
+	__stdio_flushlinebuf();
+
+	f->f_flags |= __SREADING;
+	f->f_pos = f->f_len = 0;
+	r = read(f->f_fd, f->f_buf, f->f_bufsize);
+	if (r < 0) {
+		f->f_flags |= __SERR;
+		return EOF;
+	}
+	if (r == 0) {
+		f->f_flags |= __SEOF;
+		return EOF;
+	}
+	f->f_len = r;
+	return 0;
+}
+
+/*
+ * The common output path. Data is copied into the buffer, which is
+ * written out when it fills; a line-buffered stream is also written
+ * out after any chunk containing a newline, and an unbuffered one
+ * after every chunk. A chunk at least as large as the buffer that
+ * arrives when the buffer is empty skips the copy and goes straight
+ * to write().
+ */
+size_t
+__stdio_write(FILE *f, const void *data, size_t len)
+{
+	const char *p = data;
+	size_t done, amt, i;
+	int flushit;
+
+	if ((f->f_flags & __SWR) == 0) {
+		f->f_flags |= __SERR;
+		errno = EBADF;
+		return 0;
+	}
+	if (f->f_flags & __SREADING) {
+		__stdio_rdiscard(f);
+	}
+	if (__stdio_setbuf(f)) {
+		return 0;
+	}
+
+	flushit = (f->f_mode == _IONBF);
+	if (f->f_mode == _IOLBF) {
+		for (i=0; i<len; i++) {
+			if (p[i] == '\n') {
+				flushit = 1;
+				break;
+			}
+		}
+	}
+
+	if (f->f_len == 0 && (len >= f->f_bufsize || f->f_mode == _IONBF)) {
+		return __stdio_writeall(f, p, len) ? 0 : len;
+	}
+
+	done = 0;
+	while (done < len) {
+		amt = f->f_bufsize - f->f_len;
+		if (amt > len - done) {
+			amt = len - done;
+		}
+		memcpy(f->f_buf + f->f_len, p + done, amt);
+		f->f_len += amt;
+		f->f_flags |= __SWRITING;
+		done += amt;
+		if (f->f_len == f->f_bufsize) {
+			if (__stdio_wflush(f)) {
+				return done - amt;
+			}
+		}
+	}
+	if (flushit) {
+		if (__stdio_wflush(f)) {
+			return 0;
+		}
+	}
+	return len;
+}
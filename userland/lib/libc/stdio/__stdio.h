@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _STDIO_LOCAL_H_
+#define _STDIO_LOCAL_H_
+
+/*
+ * Internals of stdio streams (for libc internal use only).
+ *
+ * A stream has one buffer that it uses for whichever direction it is
+ * currently moving data. When writing, the first f_len bytes of the
+ * buffer are waiting to be written to the file. When reading,
+ * f_pos..f_len are bytes already read from the file but not yet
+ * consumed by the caller. Switching direction on a read/write stream
+ * empties the buffer first.
+ */
+struct __file {
+	int f_fd;			/* file handle */
+	unsigned f_flags;		/* __SRD, __SWR, etc. */
+	int f_mode;			/* _IOFBF, _IOLBF, or _IONBF */
+	char *f_buf;			/* buffer, or NULL until first use */
+	size_t f_bufsize;		/* size of f_buf */
+	size_t f_pos;			/* read position within f_buf */
+	size_t f_len;			/* bytes of valid data in f_buf */
+	struct __file *f_next;		/* list of all open streams */
+};
+
+/* f_flags */
+#define __SRD		0x001	/* opened for reading */
+#define __SWR		0x002	/* opened for writing */
+#define __SREADING	0x004	/* buffer holds read-ahead data */
+#define __SWRITING	0x008	/* buffer holds pending output */
+#define __SEOF		0x010	/* end of file seen */
+#define __SERR		0x020	/* I/O error seen */
+#define __SMYBUF	0x040	/* f_buf was malloc'd by us */
+#define __SSTATIC	0x080	/* stream itself is not malloc'd */
+
+/* Set up a stream's buffer if it doesn't have one yet. */
+int __stdio_setbuf(FILE *f);
+
+/* Write out pending output. Returns 0 or EOF. */
+int __stdio_wflush(FILE *f);
+
+/* Discard read-ahead data, seeking the file back over it. */
+void __stdio_rdiscard(FILE *f);
+
+/* Refill an empty read buffer. Returns 0, or EOF on EOF or error. */
+int __stdio_fill(FILE *f);
+
+/* Queue LEN bytes of output. Returns LEN, or less on error. */
+size_t __stdio_write(FILE *f, const void *data, size_t len);
+
+/* Add a new stream to, or remove one from, the list of open streams. */
+void __stdio_link(FILE *f);
+void __stdio_unlink(FILE *f);
+
+#endif /* _STDIO_LOCAL_H_ */
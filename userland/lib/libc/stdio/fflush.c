@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "__stdio.h"
+
+/*
+ * C standard I/O functions - buffer control.
+ */
+
+/*
+ * Write out pending output. On an input stream, give back read-ahead
+ * data so the file position matches what the caller has consumed.
+ * fflush(NULL) flushes all streams.
+ */
+int
+fflush(FILE *f)
+{
+	if (f == NULL) {
+		__stdio_flushall();
+		return 0;
+	}
+	if (f->f_flags & __SREADING) {
+		__stdio_rdiscard(f);
+		return 0;
+	}
+	return __stdio_wflush(f);
+}
+
+/*
+ * Choose the buffering mode and optionally supply a buffer. This
+ * must come before any I/O on the stream.
+ */
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		errno = EINVAL;
+		return EOF;
+	}
+	if (f->f_flags & (__SREADING | __SWRITING)) {
+		errno = EBUSY;
+		return EOF;
+	}
+
+	if (f->f_flags & __SMYBUF) {
+		free(f->f_buf);
+		f->f_flags &= ~__SMYBUF;
+	}
+	f->f_buf = NULL;
+	f->f_bufsize = 0;
+	f->f_mode = mode;
+
+	if (buf != NULL && size > 0) {
+		f->f_buf = buf;
+		f->f_bufsize = size;
+	}
+	/* Otherwise __stdio_setbuf allocates one on first use. */
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "__stdio.h"
+
+/*
+ * C standard I/O functions - open and close streams.
+ */
+
+/*
+ * Parse an fopen mode string ("r", "w+", "ab", etc.) into stream
+ * flags and open() flags. Returns 0, or EINVAL.
+ */
+static
+int
+__stdio_mode(const char *mode, unsigned *sflagsret, int *oflagsret)
+{
+	unsigned sflags;
+	int oflags;
+
+	switch (*mode++) {
+	    case 'r':
+		sflags = __SRD;
+		oflags = O_RDONLY;
+		break;
+	    case 'w':
+		sflags = __SWR;
+		oflags = O_WRONLY | O_CREAT | O_TRUNC;
+		break;
+	    case 'a':
+		sflags = __SWR;
+		oflags = O_WRONLY | O_CREAT | O_APPEND;
+		break;
+	    default:
+		return EINVAL;
+	}
+	for (; *mode; mode++) {
+		if (*mode == '+') {
+			sflags = __SRD | __SWR;
+			oflags = (oflags & ~O_ACCMODE) | O_RDWR;
+		}
+		else if (*mode != 'b') {
+			return EINVAL;
+		}
+	}
+	*sflagsret = sflags;
+	*oflagsret = oflags;
+	return 0;
+}
+
+/*
+ * Create a stream for an open file handle. The buffer is allocated
+ * on first use, so setvbuf can still replace it. Streams on the
+ * console are line buffered; everything else is fully buffered.
+ */
+static
+FILE *
+__stdio_new(int fd, unsigned sflags)
+{
+	FILE *f;
+
+	f = malloc(sizeof(*f));
+	if (f == NULL) {
+		return NULL;
+	}
+	f->f_fd = fd;
+	f->f_flags = sflags;
+	f->f_mode = (fd <= STDERR_FILENO) ? _IOLBF : _IOFBF;
+	f->f_buf = NULL;
+	f->f_bufsize = 0;
+	f->f_pos = 0;
+	f->f_len = 0;
+	__stdio_link(f);
+	return f;
+}
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	unsigned sflags;
+	int oflags, fd, result;
+	FILE *f;
+
+	result = __stdio_mode(mode, &sflags, &oflags);
+	if (result) {
+		errno = result;
+		return NULL;
+	}
+	fd = open(path, oflags, 0664);
+	if (fd < 0) {
+		return NULL;
+	}
+	f = __stdio_new(fd, sflags);
+	if (f == NULL) {
+		close(fd);
+		return NULL;
+	}
+	return f;
+}
+
+FILE *
+fdopen(int fd, const char *mode)
+{
+	unsigned sflags;
+	int oflags, result;
+
+	result = __stdio_mode(mode, &sflags, &oflags);
+	if (result) {
+		errno = result;
+		return NULL;
+	}
+	return __stdio_new(fd, sflags);
+}
+
+int
+fclose(FILE *f)
+{
+	int result;
+
+	result = fflush(f);
+	if (close(f->f_fd) < 0) {
+		result = EOF;
+	}
+	__stdio_unlink(f);
+	if (f->f_flags & __SMYBUF) {
+		free(f->f_buf);
+	}
+	if (f->f_flags & __SSTATIC) {
+		f->f_flags = 0;
+	}
+	else {
+		free(f);
+	}
+	return result;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "__stdio.h"
+
+/*
+ * fprintf - C standard I/O function.
+ */
+
+/*
+ * Function passed to __vprintf to do the actual output. This only
+ * copies into the stream buffer; nothing reaches write() until the
+ * buffer fills or the stream's buffering mode says to flush.
+ */
+static
+void
+__fprintf_send(void *mydata, const char *data, size_t len)
+{
+	FILE *f = mydata;
+
+	__stdio_write(f, data, len);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/*
+ * vfprintf: call __vprintf to do the work.
+ *
+ * __vprintf sends literal text a character at a time, so on an
+ * unbuffered stream we format into a temporary buffered stream on
+ * the stack instead and write the whole result at once.
+ */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	struct __file tmp;
+	char buf[BUFSIZ];
+	int chars;
+
+	if (f->f_mode != _IONBF) {
+		chars = __vprintf(__fprintf_send, f, fmt, ap);
+	}
+	else {
+		__stdio_rdiscard(f);
+		tmp = *f;
+		tmp.f_flags &= ~(__SMYBUF | __SREADING | __SWRITING);
+		tmp.f_mode = _IOFBF;
+		tmp.f_buf = buf;
+		tmp.f_bufsize = sizeof(buf);
+		tmp.f_pos = tmp.f_len = 0;
+		tmp.f_next = NULL;
+
+		chars = __vprintf(__fprintf_send, &tmp, fmt, ap);
+		__stdio_wflush(&tmp);
+		f->f_flags |= tmp.f_flags & __SERR;
+	}
+	if (f->f_flags & __SERR) {
+		return -1;
+	}
+	return chars;
+}
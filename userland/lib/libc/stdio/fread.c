@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "__stdio.h"
+
+/*
+ * C standard I/O functions - input from a stream.
+ */
+
+size_t
+fread(void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	char *p = ptr;
+	size_t len, done, amt;
+	ssize_t r;
+
+	if (size == 0 || nitems == 0) {
+		return 0;
+	}
+	len = size * nitems;
+	done = 0;
+	while (done < len) {
+		if ((f->f_flags & __SREADING) && f->f_pos < f->f_len) {
+			amt = f->f_len - f->f_pos;
+			if (amt > len - done) {
+				amt = len - done;
+			}
+			memcpy(p + done, f->f_buf + f->f_pos, amt);
+			f->f_pos += amt;
+			done += amt;
+			continue;
+		}
+
+		/*
+		 * Buffer is empty. Read big requests straight into the
+		 * caller's memory instead of bouncing them through it.
+		 */
+		if (len - done >= BUFSIZ && (f->f_flags & __SRD) &&
+		    (f->f_flags & __SWRITING) == 0) {
+			r = read(f->f_fd, p + done, len - done);
+			if (r < 0) {
+				f->f_flags |= __SERR;
+				break;
+			}
+			if (r == 0) {
+				f->f_flags |= __SEOF;
+				break;
+			}
+			done += r;
+			continue;
+		}
+		if (__stdio_fill(f)) {
+			break;
+		}
+	}
+	return done / size;
+}
+
+int
+fgetc(FILE *f)
+{
+	if ((f->f_flags & __SREADING) == 0 || f->f_pos >= f->f_len) {
+		if (__stdio_fill(f)) {
+			return EOF;
+		}
+	}
+
+	/*
+	 * Cast through unsigned char, to prevent sign extension. This
+	 * sends back values on the range 0-255, rather than -128 to 127,
+	 * so EOF can be distinguished from legal input.
+	 */
+	return (int)(unsigned char)f->f_buf[f->f_pos++];
+}
+
+int
+getc(FILE *f)
+{
+	return fgetc(f);
+}
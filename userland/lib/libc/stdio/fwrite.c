@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "__stdio.h"
+
+/*
+ * C standard I/O functions - output to a stream.
+ */
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	size_t len;
+
+	if (size == 0 || nitems == 0) {
+		return 0;
+	}
+	len = size * nitems;
+	return __stdio_write(f, ptr, len) / size;
+}
+
+int
+fputc(int ch, FILE *f)
+{
+	unsigned char c = ch;
+
+	/*
+	 * Fast path: room in a fully or line buffered stream that is
+	 * already writing, and no newline to flush on.
+	 */
+	if ((f->f_flags & __SWRITING) && f->f_mode != _IONBF &&
+	    f->f_len + 1 < f->f_bufsize &&
+	    !(c == '\n' && f->f_mode == _IOLBF)) {
+		f->f_buf[f->f_len++] = c;
+		return c;
+	}
+	if (__stdio_write(f, &c, 1) != 1) {
+		return EOF;
+	}
+	return c;
+}
+
+int
+putc(int ch, FILE *f)
+{
+	return fputc(ch, f);
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	size_t len;
+
+	len = strlen(s);
+	if (__stdio_write(f, s, len) != len) {
+		return EOF;
+	}
+	return 0;
+}
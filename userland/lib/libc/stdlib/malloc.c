@@ -30,14 +30,39 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is a sequence of blocks, each with a header giving the
+ * offsets to its neighbors (boundary tags), so adjacent free blocks
+ * can be merged without searching. Free blocks are kept on lists by
+ * size, so malloc doesn't search the whole heap either:
+ *
+ *   - Small blocks, when freed, go on a "quick list" for their exact
+ *     size without being merged, and malloc of that size takes one
+ *     straight back off. Both are constant time.
+ *
+ *   - Other free blocks are merged with free neighbors and put in a
+ *     bin: one per size for small sizes, one per power of two above
+ *     that. Malloc takes the first block that fits from the smallest
+ *     bin that might hold one, splitting off what it doesn't need.
+ *
+ * Only if nothing fits are the quick lists emptied into the bins
+ * (merging as they go) and the search repeated, and only if that
+ * fails too is the heap grown with sbrk. When a free leaves a big
+ * enough free block at the top of the heap, the heap is shrunk again
+ * with a negative sbrk.
+ *
+ * Large requests don't use the heap at all: each gets its own
+ * page-aligned extent from mmap, which free gives straight back with
+ * munmap. That keeps big short-lived buffers from leaving holes in
+ * the heap that can't be returned.
+ *
+ * It's still intended to be easy to follow. It performs abysmally if
+ * the heap becomes larger than physical memory. To get (much) better
+ * out-of-core performance, port the kernel's malloc. :-)
  */
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
 
@@ -59,7 +84,9 @@
  *
  * mh_nextblock is the upwards offset to the next header.
  *
- * mh_pad is unused.
+ * mh_quick is 1 if the block is on a quick list. Such blocks are free
+ * as far as the user is concerned but keep mh_inuse set, so they
+ * don't get merged with their neighbors.
  * mh_inuse is 1 if the block is in use, 0 if it is free.
  * mh_magic* should always be a fixed value.
  *
@@ -78,7 +105,7 @@ struct mheader {
 	 * Block size is 8 bytes.
 	 */
 	unsigned mh_prevblock:29;
-	unsigned mh_pad:1;
+	unsigned mh_quick:1;
 	unsigned mh_magic1:2;
 
 	unsigned mh_nextblock:29;
@@ -94,7 +121,7 @@ struct mheader {
 	 * Block size is 16 bytes.
 	 */
 	unsigned mh_prevblock:62;
-	unsigned mh_pad:1;
+	unsigned mh_quick:1;
 	unsigned mh_magic1:3;
 
 	unsigned mh_nextblock:62;
@@ -133,12 +160,56 @@ struct mheader {
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Free lists.
+ *
+ * A free block's data area holds its list links (so the smallest
+ * block has room for two pointers, which is MBLOCKSIZE bytes). Quick
+ * lists only use mf_next.
+ *
+ * Quick lists and small bins are indexed by data size in blocks, 1
+ * to NQUICK. Bins above NQUICK each hold a power-of-two range of
+ * sizes; see __malloc_bin.
+ */
+struct mfree {
+	struct mheader *mf_next;
+	struct mheader *mf_prev;
+};
+
+#define M_FREE(mh)	((struct mfree *)M_DATA(mh))
+
+#define NQUICK		32
+#define QUICKSHIFT	5	/* log base 2 of NQUICK */
+#define NBINS		(NQUICK + 1 + sizeof(size_t)*8 - QUICKSHIFT)
+
+/*
+ * Requests of MLARGE bytes or more get their own extent (rounded up
+ * to MPAGESIZE, the OS/161 page size; on machines with bigger pages
+ * this only wastes a little). A free block of MTRIM bytes or more at
+ * the top of the heap is given back to the system. The quick lists
+ * are emptied when they hold MTRIM bytes, so that they can't keep
+ * much memory from being merged and given back.
+ *
+ * A large block has a normal header at the start of its extent, with
+ * mh_prevblock 0 and mh_inuse set; free recognizes it because it
+ * isn't inside the heap.
+ */
+#define MPAGESIZE	4096
+#define MLARGE		(8 * MPAGESIZE)
+#define MTRIM		(16 * MPAGESIZE)
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, the
+ * highest block in it (NULL if none), and the free lists.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__heaplast;
+static struct mheader *__quick[NQUICK + 1];
+static struct mheader *__bins[NBINS];
+static size_t __quickbytes;	/* total size of blocks in quick lists */
+static int __nomap;	/* set if mmap isn't there; use the heap */
 
 /*
  * Setup function.
@@ -161,6 +232,12 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfree) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - no room for free links");
+	}
+	if (1<<QUICKSHIFT != NQUICK) {
+		errx(1, "malloc: Internal error - QUICKSHIFT wrong");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -220,6 +297,7 @@ __malloc_dump(void)
 	warnx("heap: ************************************************");
 
 	rightprevblock = 0;
+	mh = NULL;
 	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
 		mh = (struct mheader *) i;
 		if (!M_OK(mh)) {
@@ -241,11 +319,16 @@ __malloc_dump(void)
 		      (unsigned long) i + MBLOCKSIZE,
 		      (unsigned long) M_SIZE(mh),
 		      (unsigned long) (i+M_NEXTOFF(mh)),
+		      mh->mh_quick ? "QUICK" :
 		      mh->mh_inuse ? "INUSE" : "FREE");
 	}
 	if (i!=__heaptop) {
 		errx(1, "malloc: Heap corrupt; ran off end");
 	}
+	if (mh != __heaplast) {
+		errx(1, "malloc: Heap corrupt; last block is %p, not %p",
+		     mh, __heaplast);
+	}
 
 	warnx("heap: ************************************************");
 }
@@ -279,10 +362,94 @@ __malloc_sbrk(size_t size)
 	return x;
 }
 
+/*
+ * Which bin a free block of SIZE data bytes goes in: the block count
+ * itself up to NQUICK, then one bin per power of two.
+ */
+static
+unsigned
+__malloc_bin(size_t size)
+{
+	size_t n = size >> MBLOCKSHIFT;
+	unsigned b;
+
+	if (n <= NQUICK) {
+		return n;
+	}
+	for (b = QUICKSHIFT; (n >> b) > 1; b++) {
+		/* nothing */
+	}
+	return NQUICK + 1 + b - QUICKSHIFT;
+}
+
+/*
+ * Put a free block in its bin.
+ */
+static
+void
+__malloc_link(struct mheader *mh)
+{
+	unsigned b = __malloc_bin(M_SIZE(mh));
+	struct mheader *head = __bins[b];
+
+	M_FREE(mh)->mf_next = head;
+	M_FREE(mh)->mf_prev = NULL;
+	if (head != NULL) {
+		M_FREE(head)->mf_prev = mh;
+	}
+	__bins[b] = mh;
+}
+
+/*
+ * Take a free block out of its bin.
+ */
+static
+void
+__malloc_unlink(struct mheader *mh)
+{
+	struct mfree *mf = M_FREE(mh);
+
+	if (mf->mf_prev != NULL) {
+		M_FREE(mf->mf_prev)->mf_next = mf->mf_next;
+	}
+	else {
+		__bins[__malloc_bin(M_SIZE(mh))] = mf->mf_next;
+	}
+	if (mf->mf_next != NULL) {
+		M_FREE(mf->mf_next)->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * Find a free block with at least SIZE bytes of data. Every block in
+ * a bin above SIZE's own is big enough, so only SIZE's own bin can
+ * need more than a look at its first block.
+ */
+static
+struct mheader *
+__malloc_findfree(size_t size)
+{
+	struct mheader *mh;
+	unsigned b;
+
+	for (b = __malloc_bin(size); b < NBINS; b++) {
+		for (mh = __bins[b]; mh != NULL; mh = M_FREE(mh)->mf_next) {
+			if (!M_OK(mh) || mh->mh_inuse) {
+				errx(1, "malloc: Heap corrupt; bad block %p "
+				     "in free list", mh);
+			}
+			if (M_SIZE(mh) >= size) {
+				return mh;
+			}
+		}
+	}
+	return NULL;
+}
+
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * MBLOCKSIZE. The new block goes in its bin.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
@@ -315,7 +482,7 @@ __malloc_split(struct mheader *mh, size_t size)
 	}
 
 	mhnew->mh_prevblock = M_MKFIELD(size + MBLOCKSIZE);
-	mhnew->mh_pad = 0;
+	mhnew->mh_quick = 0;
 	mhnew->mh_magic1 = MMAGIC;
 	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
 	mhnew->mh_inuse = 0;
@@ -324,8 +491,54 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	else {
+		__heaplast = mhnew;
+	}
+
+	/*
+	 * The block above, if any, is in use (or it would have been
+	 * merged with the one we split), so there's nothing to merge.
+	 */
+	__malloc_link(mhnew);
+}
+
+/*
+ * Allocate a large block of SIZE data bytes in an extent of its own.
+ * Returns NULL if mmap fails; if that's because there's no mmap, we
+ * don't try again.
+ */
+static
+struct mheader *
+__malloc_large(size_t size)
+{
+	struct mheader *mh;
+	size_t extent;
+
+	if (size > (size_t)-1 - 2*MPAGESIZE) {
+		return NULL;
+	}
+	extent = (size + MBLOCKSIZE + MPAGESIZE - 1) & ~(size_t)(MPAGESIZE-1);
+	mh = mmap(NULL, extent, PROT_READ|PROT_WRITE,
+		  MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (mh == MAP_FAILED) {
+		if (errno == ENOSYS) {
+			__nomap = 1;
+		}
+		return NULL;
+	}
+
+	/* Hand out the whole extent; there's no one to share it with. */
+	mh->mh_prevblock = 0;
+	mh->mh_magic1 = MMAGIC;
+	mh->mh_magic2 = MMAGIC;
+	mh->mh_quick = 0;
+	mh->mh_inuse = 1;
+	mh->mh_nextblock = M_MKFIELD(extent);
+	return mh;
 }
 
+static void __malloc_flushquick(void);
+
 /*
  * malloc itself.
  */
@@ -333,8 +546,7 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+	size_t n;
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -351,75 +563,84 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Round size up to an integral number of blocks, and at least
+	 * one, so there's room for the free list links later.
 	 */
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
+	n = size >> MBLOCKSHIFT;
 
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
+	/* Large sizes get an extent of their own, if possible. */
+	if (size >= MLARGE && !__nomap) {
+		mh = __malloc_large(size);
+		if (mh != NULL) {
+			goto done;
 		}
+		/* Try the heap; it might have room. */
+	}
 
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
+	/* Small sizes: try the quick list first. */
+	if (n <= NQUICK && __quick[n] != NULL) {
+		mh = __quick[n];
+		if (!M_OK(mh) || !mh->mh_quick || M_SIZE(mh) != size) {
+			errx(1, "malloc: Heap corrupt; bad block %p "
+			     "in quick list", mh);
 		}
+		__quick[n] = M_FREE(mh)->mf_next;
+		__quickbytes -= size;
+		mh->mh_quick = 0;
+		goto done;
+	}
 
-		/* Try splitting block. */
+	/*
+	 * Then the bins. If nothing fits, merge whatever is sitting
+	 * in the quick lists and look again.
+	 */
+	mh = __malloc_findfree(size);
+	if (mh == NULL && __quickbytes > 0) {
+		__malloc_flushquick();
+		mh = __malloc_findfree(size);
+	}
+	if (mh != NULL) {
+		__malloc_unlink(mh);
 		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
 		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
-	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+		goto done;
 	}
 
 	/*
-	 * Didn't find anything. Expand the heap.
+	 * Didn't find anything. Expand the heap. If the block at the
+	 * top is free, grow that instead of starting a new one.
 	 */
 
+	mh = __heaplast;
+	if (mh != NULL && !mh->mh_inuse) {
+		if (__malloc_sbrk(size - M_SIZE(mh)) == NULL) {
+			return NULL;
+		}
+		__malloc_unlink(mh);
+		mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
+		mh->mh_inuse = 1;
+		goto done;
+	}
+
 	mh = __malloc_sbrk(size + MBLOCKSIZE);
 	if (mh == NULL) {
 		return NULL;
 	}
 
-	mh->mh_prevblock = rightprevblock;
+	mh->mh_prevblock = __heaplast ? __heaplast->mh_nextblock : 0;
 	mh->mh_magic1 = MMAGIC;
 	mh->mh_magic2 = MMAGIC;
-	mh->mh_pad = 0;
+	mh->mh_quick = 0;
 	mh->mh_inuse = 1;
 	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
+	__heaplast = mh;
 
+ done:
 #ifdef MALLOCDEBUG
 	warnx("malloc: allocating at %p", M_DATA(mh));
 	__malloc_dump();
@@ -445,7 +666,8 @@ __malloc_deadbeef(void *ptr, size_t size)
 }
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Attempt to merge two adjacent blocks (mh below mhnext). Neither
+ * may be in a bin.
  */
 static
 void
@@ -470,18 +692,121 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	if (mhnextnext != (struct mheader *)__heaptop) {
 		mhnextnext->mh_prevblock = mh->mh_nextblock;
 	}
+	else {
+		__heaplast = mh;
+	}
 
 	/* Deadbeef out the memory used by the now-obsolete header */
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
 }
 
+/*
+ * Merge a newly free block with any free neighbors, and put the
+ * result in its bin. Returns the merged block.
+ */
+static
+struct mheader *
+__malloc_release(struct mheader *mh)
+{
+	struct mheader *mhnext, *mhprev;
+
+	/* Try merging with the block above (but not if we're at the top) */
+	mhnext = M_NEXT(mh);
+	if (mhnext != (struct mheader *)__heaptop) {
+		if (!mhnext->mh_inuse) {
+			__malloc_unlink(mhnext);
+		}
+		__malloc_trymerge(mh, mhnext);
+	}
+
+	/* Try merging with the block below (but not if we're at the bottom) */
+	if (mh != (struct mheader *)__heapbase) {
+		mhprev = M_PREV(mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_unlink(mhprev);
+		}
+		__malloc_trymerge(mhprev, mh);
+		if (!mhprev->mh_inuse) {
+			mh = mhprev;
+		}
+	}
+
+	__malloc_link(mh);
+	return mh;
+}
+
+/*
+ * Called when the block at the top of the heap may have become free.
+ * If it's at least MTRIM bytes, give it back to the system. Blocks
+ * parked on the quick lists can keep it from merging with its
+ * neighbors, or be left on top once it's gone; if so, empty the
+ * quick lists and look again.
+ */
+static
+void
+__malloc_trim(void)
+{
+	struct mheader *mh;
+	size_t size;
+
+	for (;;) {
+		mh = __heaplast;
+		if (mh != NULL && __quickbytes > 0 &&
+		    (mh->mh_quick || (!mh->mh_inuse && M_SIZE(mh) < MTRIM))) {
+			__malloc_flushquick();
+			mh = __heaplast;
+		}
+		if (mh == NULL || mh->mh_inuse || M_SIZE(mh) < MTRIM) {
+			return;
+		}
+		size = M_NEXTOFF(mh);
+
+		__malloc_unlink(mh);
+		if (mh == (struct mheader *)__heapbase) {
+			__heaplast = NULL;
+		}
+		else {
+			__heaplast = M_PREV(mh);
+		}
+
+		if (sbrk(-(intptr_t)size) == (void *)-1) {
+			err(1, "malloc: sbrk failed shrinking heap");
+		}
+		__heaptop -= size;
+	}
+}
+
+/*
+ * Empty the quick lists, merging their blocks into the bins.
+ */
+static
+void
+__malloc_flushquick(void)
+{
+	struct mheader *mh;
+	unsigned n;
+
+	for (n=1; n<=NQUICK; n++) {
+		while (__quick[n] != NULL) {
+			mh = __quick[n];
+			__quick[n] = M_FREE(mh)->mf_next;
+			mh->mh_quick = 0;
+			mh->mh_inuse = 0;
+			__malloc_release(mh);
+		}
+	}
+	__quickbytes = 0;
+}
+
 /*
  * The actual free() implementation.
  */
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct mheader *mh;
+	size_t n;
+	int attop;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -495,9 +820,22 @@ free(void *x)
 		     (unsigned long) __heapbase, (unsigned long) __heaptop);
 	}
 
-	/* Don't allow freeing pointers that aren't on the heap. */
+	/*
+	 * Pointers that aren't on the heap must be large blocks; see
+	 * __malloc_large. The header must be at the start of a page
+	 * and look like one.
+	 */
 	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop) {
-		errx(1, "free: Invalid pointer %p freed (out of range)", x);
+		mh = ((struct mheader *)x)-1;
+		if ((uintptr_t)mh % MPAGESIZE != 0 || !M_OK(mh) ||
+		    !mh->mh_inuse || mh->mh_quick || mh->mh_prevblock != 0) {
+			errx(1, "free: Invalid pointer %p freed "
+			     "(out of range)", x);
+		}
+		if (munmap(mh, M_NEXTOFF(mh)) < 0) {
+			err(1, "free: munmap of %p failed", x);
+		}
+		return;
 	}
 
 #ifdef MALLOCDEBUG
@@ -510,26 +848,42 @@ free(void *x)
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
 	}
 
-	if (!mh->mh_inuse) {
+	if (!mh->mh_inuse || mh->mh_quick) {
 		errx(1, "free: Invalid pointer %p freed (already free)", x);
 	}
 
-	/* mark it free */
-	mh->mh_inuse = 0;
-
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
-	}
+	/*
+	 * Small blocks are parked on their quick list, unmerged, unless
+	 * they're at the top of the heap (or just below a free block
+	 * that is); those are merged so the heap can shrink.
+	 */
+	n = M_SIZE(mh) >> MBLOCKSHIFT;
+	attop = mh == __heaplast ||
+		(M_NEXT(mh) == __heaplast && !__heaplast->mh_inuse);
+	if (n <= NQUICK && !attop) {
+		mh->mh_quick = 1;
+		M_FREE(mh)->mf_next = __quick[n];
+		__quick[n] = mh;
+		__quickbytes += M_SIZE(mh);
 
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+		/*
+		 * Don't let the quick lists sit on too much; they keep
+		 * blocks from merging, and the heap from shrinking.
+		 */
+		if (__quickbytes >= MTRIM) {
+			__malloc_flushquick();
+			__malloc_trim();
+		}
+	}
+	else {
+		/* mark it free, then merge it and bin it */
+		mh->mh_inuse = 0;
+		if (__malloc_release(mh) == __heaplast) {
+			__malloc_trim();
+		}
 	}
 
 #ifdef MALLOCDEBUG
@@ -20,6 +20,12 @@ awk '
 	print $2, $3;
     }
 ' | awk '{
+	# fork and execv get wrappers in libc (unix/fork.c and
+	# unix/execv.c) that flush stdio first; the stubs are __fork
+	# and __execv.
+	if ($1 == "fork" || $1 == "execv") {
+		$1 = "__" $1;
+	}
 	# output something simple that will work in syscalls.S.
 	printf "SYSCALL(%s, %s)\n", $1, $2;
 }'
@@ -84,6 +84,12 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 	 */
 	errmsg = strerror(errno);
 
+	/*
+	 * stderr output goes straight to write(), so push out anything
+	 * still buffered on stdout first to keep the two in order.
+	 */
+	fflush(stdout);
+
 	/*
 	 * Look up the program name.
 	 * Strictly speaking we should pull off the rightmost
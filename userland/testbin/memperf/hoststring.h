@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HOSTSTRING_H
+#define HOSTSTRING_H
+
+/*
+ * In the host build, use OS/161's string functions (compiled in by
+ * hoststring.c under other names) instead of the host libc's, so
+ * memperf, strperf, and strfuzz can measure and test them on the
+ * host too. In the native build they're the libc ones anyway and
+ * this does nothing.
+ *
+ * Include this after <string.h>.
+ */
+
+#ifdef HOST
+
+#define memcpy	os161_memcpy
+#define memmove	os161_memmove
+#define memset	os161_memset
+#define bzero	os161_bzero
+#define strlen	os161_strlen
+#define strcmp	os161_strcmp
+#define strchr	os161_strchr
+#define strcpy	os161_strcpy
+
+void *os161_memcpy(void *dst, const void *src, size_t len);
+void *os161_memmove(void *dst, const void *src, size_t len);
+void *os161_memset(void *ptr, int ch, size_t len);
+void os161_bzero(void *ptr, size_t len);
+size_t os161_strlen(const char *str);
+int os161_strcmp(const char *a, const char *b);
+char *os161_strchr(const char *s, int ch);
+char *os161_strcpy(char *dest, const char *src);
+
+#endif /* HOST */
+
+#endif /* HOSTSTRING_H */
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * memperf - measure memcpy, memmove, and memset.
+ *
+ * For a range of sizes and source/destination alignments, times
+ * libc's versions against simple reference versions (the ones libc
+ * used to have: whole words when everything is word-aligned, bytes
+ * otherwise), after checking that both give the same results.
+ *
+ * Also builds for the host, where it measures OS/161's versions
+ * rather than the host's; see hoststring.h.
+ *
+ * Usage: memperf [scale]
+ * Each measurement moves about SCALE megabytes (default 1).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#ifdef HOST
+#include "hostcompat.h"
+#endif
+#include "hoststring.h"
+
+#define MAXSIZE		32768
+#define SLOP		16
+
+static const size_t sizes[] = { 8, 64, 512, 4096, MAXSIZE };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Destination and source offsets from word alignment. */
+static const struct {
+	unsigned doff, soff;
+} aligns[] = {
+	{ 0, 0 },
+	{ 1, 1 },
+	{ 0, 1 },
+	{ 3, 2 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(aligns[0]))
+
+static unsigned char *srcbuf, *dstbuf, *refbuf;
+
+////////////////////////////////////////////////////////////
+// reference versions
+
+static
+void *
+ref_memcpy(void *dst, const void *src, size_t len)
+{
+	size_t i;
+
+	if ((uintptr_t)dst % sizeof(long) == 0 &&
+	    (uintptr_t)src % sizeof(long) == 0 &&
+	    len % sizeof(long) == 0) {
+		long *d = dst;
+		const long *s = src;
+
+		for (i=0; i<len/sizeof(long); i++) {
+			d[i] = s[i];
+		}
+	}
+	else {
+		char *d = dst;
+		const char *s = src;
+
+		for (i=0; i<len; i++) {
+			d[i] = s[i];
+		}
+	}
+	return dst;
+}
+
+static
+void *
+ref_memmove(void *dst, const void *src, size_t len)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t i;
+
+	if ((uintptr_t)dst < (uintptr_t)src) {
+		return ref_memcpy(dst, src, len);
+	}
+	for (i=len; i>0; i--) {
+		d[i-1] = s[i-1];
+	}
+	return dst;
+}
+
+static
+void *
+ref_memset(void *ptr, int ch, size_t len)
+{
+	char *p = ptr;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = ch;
+	}
+	return ptr;
+}
+
+////////////////////////////////////////////////////////////
+// timing
+
+static
+uint64_t
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Megabytes per second for BYTES bytes in NS nanoseconds, rounded.
+ */
+static
+unsigned long
+rate(uint64_t bytes, uint64_t ns)
+{
+	if (ns == 0) {
+		ns = 1;
+	}
+	return (unsigned long)((bytes * 1000 + ns / 2) / ns);
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+fill(unsigned char *buf, size_t len, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[i] = (unsigned char)(seed + i * 7 + (i >> 8));
+	}
+}
+
+/*
+ * Copy with both versions, or move within the destination buffer if
+ * MOVE is set, and compare the whole buffers so that writes outside
+ * the range show up too.
+ */
+static
+void
+check(const char *name, bool move, size_t size,
+      unsigned doff, unsigned soff)
+{
+	fill(srcbuf, MAXSIZE + 2*SLOP, 1);
+	fill(dstbuf, MAXSIZE + 2*SLOP, 2);
+	fill(refbuf, MAXSIZE + 2*SLOP, 2);
+	if (move) {
+		memmove(dstbuf + doff, dstbuf + soff, size);
+		ref_memmove(refbuf + doff, refbuf + soff, size);
+	}
+	else {
+		memcpy(dstbuf + doff, srcbuf + soff, size);
+		ref_memcpy(refbuf + doff, srcbuf + soff, size);
+	}
+	if (memcmp(dstbuf, refbuf, MAXSIZE + 2*SLOP) != 0) {
+		errx(1, "%s: wrong result for size %lu, offsets %u/%u",
+		     name, (unsigned long)size, doff, soff);
+	}
+}
+
+static
+void
+checkset(size_t size, unsigned doff)
+{
+	fill(dstbuf, MAXSIZE + 2*SLOP, 3);
+	fill(refbuf, MAXSIZE + 2*SLOP, 3);
+	memset(dstbuf + doff, 0xa5, size);
+	ref_memset(refbuf + doff, 0xa5, size);
+	if (memcmp(dstbuf, refbuf, MAXSIZE + 2*SLOP) != 0) {
+		errx(1, "memset: wrong result for size %lu, offset %u",
+		     (unsigned long)size, doff);
+	}
+}
+
+typedef void *(*copyfn)(void *, const void *, size_t);
+
+static
+uint64_t
+timecopy(copyfn fn, unsigned char *dst, const unsigned char *src,
+	 size_t size, unsigned long iters)
+{
+	uint64_t start;
+	unsigned long i;
+
+	start = now();
+	for (i=0; i<iters; i++) {
+		fn(dst, src, size);
+	}
+	return now() - start;
+}
+
+static
+uint64_t
+timeset(void *(*fn)(void *, int, size_t), unsigned char *dst,
+	size_t size, unsigned long iters)
+{
+	uint64_t start;
+	unsigned long i;
+
+	start = now();
+	for (i=0; i<iters; i++) {
+		fn(dst, (int)i, size);
+	}
+	return now() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long scale, iters;
+	uint64_t bytes, oldns, newns;
+	unsigned i, j, doff, soff;
+	size_t size;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	if (argc > 2) {
+		errx(1, "Usage: memperf [scale]");
+	}
+	scale = 1;
+	if (argc == 2) {
+		scale = atoi(argv[1]);
+		if (scale == 0) {
+			errx(1, "memperf: scale must be positive");
+		}
+	}
+
+	srcbuf = malloc(MAXSIZE + 2*SLOP);
+	dstbuf = malloc(MAXSIZE + 2*SLOP);
+	refbuf = malloc(MAXSIZE + 2*SLOP);
+	if (srcbuf == NULL || dstbuf == NULL || refbuf == NULL) {
+		errx(1, "memperf: out of memory");
+	}
+
+	/* First make sure the answers are right. */
+	for (i=0; i<NSIZES; i++) {
+		for (doff=0; doff<SLOP; doff++) {
+			checkset(sizes[i], doff);
+			for (soff=0; soff<SLOP; soff++) {
+				check("memcpy", false, sizes[i], doff, soff);
+				check("memmove", true, sizes[i], doff, soff);
+			}
+		}
+	}
+	printf("memperf: results check out\n");
+
+	printf("%-8s %6s %5s %9s %9s\n",
+	       "", "size", "align", "old MB/s", "new MB/s");
+	for (i=0; i<NSIZES; i++) {
+		size = sizes[i];
+		iters = scale * 1024 * 1024 / size;
+		bytes = (uint64_t)iters * size;
+		for (j=0; j<NALIGNS; j++) {
+			doff = aligns[j].doff;
+			soff = aligns[j].soff;
+			oldns = timecopy(ref_memcpy, dstbuf + doff,
+					 srcbuf + soff, size, iters);
+			newns = timecopy(memcpy, dstbuf + doff,
+					 srcbuf + soff, size, iters);
+			printf("%-8s %6lu   %u/%u %9lu %9lu\n", "memcpy",
+			       (unsigned long)size, doff, soff,
+			       rate(bytes, oldns), rate(bytes, newns));
+		}
+		/* Overlapping, so memmove has to go backwards. */
+		oldns = timecopy(ref_memmove, dstbuf + SLOP/2 + 1,
+				 dstbuf, size, iters);
+		newns = timecopy(memmove, dstbuf + SLOP/2 + 1,
+				 dstbuf, size, iters);
+		printf("%-8s %6lu   %u/%u %9lu %9lu\n", "memmove",
+		       (unsigned long)size, SLOP/2 + 1, 0,
+		       rate(bytes, oldns), rate(bytes, newns));
+		for (doff=0; doff<2; doff++) {
+			oldns = timeset(ref_memset, dstbuf + doff,
+					size, iters);
+			newns = timeset(memset, dstbuf + doff,
+					size, iters);
+			printf("%-8s %6lu   %u   %9lu %9lu\n", "memset",
+			       (unsigned long)size, doff,
+			       rate(bytes, oldns), rate(bytes, newns));
+		}
+	}
+
+	free(srcbuf);
+	free(dstbuf);
+	free(refbuf);
+	return 0;
+}
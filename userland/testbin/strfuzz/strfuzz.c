@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * strfuzz - check strlen, strcmp, strchr, and strcpy against simple
+ * reference versions on lots of random strings.
+ *
+ * The word-at-a-time versions in libc read whole aligned words, so
+ * besides getting the answers right they must never read past the
+ * aligned word holding the terminator. To check that, strings are
+ * also placed so they end right at the end of a page. In the host
+ * build the next page is made inaccessible, so any such read
+ * crashes; OS/161 has no mprotect, so there it's only as good as
+ * whatever happens to follow.
+ *
+ * Also builds for the host, where it tests OS/161's versions rather
+ * than the host's; see ../memperf/hoststring.h.
+ *
+ * Usage: strfuzz [iterations [seed]]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#ifdef HOST
+#include <sys/mman.h>
+#include "hostcompat.h"
+#endif
+#include "hoststring.h"
+
+#define PAGESIZE	4096
+#define MAXLEN		300
+#define DEFITERS	20000
+
+/*
+ * Two pages for strings; on the host, followed by a guard page.
+ */
+static char *area;
+static char copybuf[MAXLEN + 64];
+
+////////////////////////////////////////////////////////////
+// reference versions
+
+static
+size_t
+ref_strlen(const char *str)
+{
+	size_t ret = 0;
+
+	while (str[ret]) {
+		ret++;
+	}
+	return ret;
+}
+
+static
+int
+ref_strcmp(const char *a, const char *b)
+{
+	size_t i;
+
+	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
+		/* nothing */
+	}
+	if ((unsigned char)a[i] > (unsigned char)b[i]) {
+		return 1;
+	}
+	else if (a[i] == b[i]) {
+		return 0;
+	}
+	return -1;
+}
+
+static
+const char *
+ref_strchr(const char *s, int ch_arg)
+{
+	const char ch = ch_arg;
+
+	while (*s) {
+		if (*s == ch) {
+			return s;
+		}
+		s++;
+	}
+	if (*s == ch) {
+		return s;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+// setup
+
+static
+void
+setup(void)
+{
+#ifdef HOST
+	area = mmap(NULL, 3*PAGESIZE, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (area == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	if (mprotect(area + 2*PAGESIZE, PAGESIZE, PROT_NONE) < 0) {
+		err(1, "mprotect");
+	}
+#else
+	area = malloc(3*PAGESIZE);
+	if (area == NULL) {
+		errx(1, "out of memory");
+	}
+	/* Round up to a page so strings can end at a page boundary. */
+	area += PAGESIZE - (uintptr_t)area % PAGESIZE;
+#endif
+}
+
+/*
+ * Pick a random byte for a string. Mostly letters, but often the top
+ * bit is set, so that signed/unsigned mixups show up.
+ */
+static
+char
+randchar(void)
+{
+	long r = random();
+
+	if (r % 4 == 0) {
+		return (char)(0x80 + (r >> 2) % 0x80);
+	}
+	return (char)('a' + (r >> 2) % 8);
+}
+
+/*
+ * Make a random string of length LEN. If ATEND, it ends right before
+ * the guard page; otherwise it starts anywhere in the first page.
+ * (Strings in the two places never overlap, as A and B may need to
+ * exist at once.)
+ */
+static
+char *
+mkstring(size_t len, bool atend)
+{
+	char *s;
+	size_t i;
+
+	if (atend) {
+		s = area + 2*PAGESIZE - (len + 1);
+	}
+	else {
+		s = area + random() % (PAGESIZE - MAXLEN - 1);
+	}
+	for (i=0; i<len; i++) {
+		s[i] = randchar();
+	}
+	s[len] = 0;
+	return s;
+}
+
+////////////////////////////////////////////////////////////
+// checks
+
+static unsigned long iteration;
+
+static
+void
+fail(const char *fn, const char *s)
+{
+	errx(1, "%s: wrong answer at iteration %lu (string at %p, "
+	     "length %lu)", fn, iteration, s, (unsigned long)ref_strlen(s));
+}
+
+static
+int
+sign(int x)
+{
+	return x < 0 ? -1 : x > 0 ? 1 : 0;
+}
+
+static
+void
+check_strlen(const char *s)
+{
+	if (strlen(s) != ref_strlen(s)) {
+		fail("strlen", s);
+	}
+}
+
+static
+void
+check_strchr(const char *s)
+{
+	size_t len;
+	int ch;
+
+	len = ref_strlen(s);
+	switch (random() % 3) {
+	    case 0:
+		/* something in the string, or its terminator */
+		ch = (unsigned char)s[random() % (len + 1)];
+		break;
+	    case 1:
+		/* probably not in the string */
+		ch = (unsigned char)randchar() ^ 0x10;
+		break;
+	    default:
+		/* as an int, which strchr must convert to char */
+		ch = (signed char)randchar();
+		break;
+	}
+	if (strchr(s, ch) != ref_strchr(s, ch)) {
+		fail("strchr", s);
+	}
+}
+
+/*
+ * Compare A against a variant of itself: identical, with one byte
+ * changed, cut short, or with one byte made bigger and then cut
+ * short right after it.
+ */
+static
+void
+check_strcmp(const char *a, char *b)
+{
+	size_t len, pos;
+
+	len = ref_strlen(a);
+	memmove(b, a, len + 1);
+	pos = len ? random() % len : 0;
+	switch (random() % 4) {
+	    case 0:
+		break;
+	    case 1:
+		if (len > 0) {
+			b[pos] = randchar();
+		}
+		break;
+	    case 2:
+		b[pos] = 0;
+		break;
+	    default:
+		if (pos + 1 < len) {
+			b[pos + 1] = 0;
+			b[pos] = a[pos] + 1;
+		}
+		break;
+	}
+	if (sign(strcmp(a, b)) != ref_strcmp(a, b) ||
+	    sign(strcmp(b, a)) != ref_strcmp(b, a)) {
+		fail("strcmp", a);
+	}
+}
+
+/*
+ * Copy S to a random alignment in COPYBUF and check the copy and
+ * that nothing around it changed.
+ */
+static
+void
+check_strcpy(const char *s)
+{
+	size_t len, off, i;
+	char *d;
+
+	len = ref_strlen(s);
+	off = random() % 16;
+	memset(copybuf, '#', sizeof(copybuf));
+	d = copybuf + off;
+	if (strcpy(d, s) != d || ref_strcmp(d, s) != 0) {
+		fail("strcpy", s);
+	}
+	for (i=0; i<sizeof(copybuf); i++) {
+		if (i >= off && i <= off + len) {
+			continue;
+		}
+		if (copybuf[i] != '#') {
+			fail("strcpy", s);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long iters, seed;
+	size_t len;
+	char *a, *b;
+	bool atend;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	if (argc > 3) {
+		errx(1, "Usage: strfuzz [iterations [seed]]");
+	}
+	iters = argc > 1 ? (unsigned long)atoi(argv[1]) : DEFITERS;
+	seed = argc > 2 ? (unsigned long)atoi(argv[2]) : 0;
+	srandom(seed);
+	setup();
+
+	for (iteration = 0; iteration < iters; iteration++) {
+		/* Mostly short strings, where the edge cases are. */
+		len = random() % 4 ? random() % 24 : random() % MAXLEN;
+		atend = random() % 2;
+		a = mkstring(len, atend);
+		/* B goes wherever A didn't. */
+		b = mkstring(len, !atend);
+
+		check_strlen(a);
+		check_strchr(a);
+		check_strcmp(a, b);
+		check_strcpy(a);
+	}
+
+	printf("strfuzz: %lu strings passed (seed %lu)\n", iters, seed);
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * strperf - measure strlen, strcmp, strchr, and strcpy.
+ *
+ * Times libc's versions against the simple character-at-a-time
+ * versions libc used to have, for several string lengths and
+ * alignments. Correctness is strfuzz's job; this only checks the
+ * two versions agree on the strings it times.
+ *
+ * Also builds for the host, where it measures OS/161's versions
+ * rather than the host's; see ../memperf/hoststring.h. (The host
+ * compiler may still recognize ref_strlen and call the host's own
+ * strlen for it, so take the "old" strlen numbers there with salt.)
+ *
+ * Usage: strperf [scale]
+ * Each measurement goes over about SCALE megabytes of string
+ * (default 1).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#ifdef HOST
+#include "hostcompat.h"
+#endif
+#include "hoststring.h"
+
+#define MAXLEN		1024
+#define SLOP		16
+
+static const size_t lengths[] = { 8, 32, 128, MAXLEN };
+#define NLENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+
+/* Offsets of the two strings from word alignment. */
+static const struct {
+	unsigned aoff, boff;
+} aligns[] = {
+	{ 0, 0 },
+	{ 1, 1 },
+	{ 0, 1 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(aligns[0]))
+
+static char abuf[MAXLEN + 2*SLOP], bbuf[MAXLEN + 2*SLOP];
+
+/* Results go here so the calls can't be optimized away. */
+static volatile unsigned long sink;
+
+////////////////////////////////////////////////////////////
+// reference versions
+
+static
+size_t
+ref_strlen(const char *str)
+{
+	size_t ret = 0;
+
+	while (str[ret]) {
+		ret++;
+	}
+	return ret;
+}
+
+static
+int
+ref_strcmp(const char *a, const char *b)
+{
+	size_t i;
+
+	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
+		/* nothing */
+	}
+	if ((unsigned char)a[i] > (unsigned char)b[i]) {
+		return 1;
+	}
+	else if (a[i] == b[i]) {
+		return 0;
+	}
+	return -1;
+}
+
+static
+char *
+ref_strchr(const char *s, int ch_arg)
+{
+	const char ch = ch_arg;
+
+	while (*s) {
+		if (*s == ch) {
+			return (char *)s;
+		}
+		s++;
+	}
+	if (*s == ch) {
+		return (char *)s;
+	}
+	return NULL;
+}
+
+static
+char *
+ref_strcpy(char *dest, const char *src)
+{
+	size_t i;
+
+	for (i=0; src[i]; i++) {
+		dest[i] = src[i];
+	}
+	dest[i] = 0;
+	return dest;
+}
+
+////////////////////////////////////////////////////////////
+// timing
+
+static
+uint64_t
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Megabytes per second for BYTES bytes in NS nanoseconds, rounded.
+ */
+static
+unsigned long
+rate(uint64_t bytes, uint64_t ns)
+{
+	if (ns == 0) {
+		ns = 1;
+	}
+	return (unsigned long)((bytes * 1000 + ns / 2) / ns);
+}
+
+/*
+ * Which function to time, with which version.
+ */
+enum which { W_STRLEN, W_STRCMP, W_STRCHR, W_STRCPY };
+static const char *const names[] = { "strlen", "strcmp", "strchr", "strcpy" };
+
+static
+uint64_t
+timeit(enum which fn, bool ref, char *a, char *b, unsigned long iters)
+{
+	uint64_t start;
+	unsigned long i, total;
+
+	total = 0;
+	start = now();
+	for (i=0; i<iters; i++) {
+		switch (fn) {
+		    case W_STRLEN:
+			total += ref ? ref_strlen(a) : strlen(a);
+			break;
+		    case W_STRCMP:
+			total += ref ? ref_strcmp(a, b) : strcmp(a, b);
+			break;
+		    case W_STRCHR:
+			total += (uintptr_t)(ref ? ref_strchr(a, '!') :
+					     strchr(a, '!'));
+			break;
+		    case W_STRCPY:
+			total += (uintptr_t)(ref ? ref_strcpy(b, a) :
+					     strcpy(b, a));
+			break;
+		}
+	}
+	sink = total;
+	return now() - start;
+}
+
+/*
+ * Put a string of LEN letters at BUF + OFF.
+ */
+static
+char *
+mkstring(char *buf, unsigned off, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[off + i] = 'a' + i % 26;
+	}
+	buf[off + len] = 0;
+	return buf + off;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long scale, iters;
+	uint64_t bytes, oldns, newns;
+	unsigned i, j;
+	enum which fn;
+	size_t len;
+	char *a, *b;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	if (argc > 2) {
+		errx(1, "Usage: strperf [scale]");
+	}
+	scale = 1;
+	if (argc == 2) {
+		scale = atoi(argv[1]);
+		if (scale == 0) {
+			errx(1, "strperf: scale must be positive");
+		}
+	}
+
+	printf("%-8s %6s %5s %9s %9s\n",
+	       "", "length", "align", "old MB/s", "new MB/s");
+	for (fn = W_STRLEN; fn <= W_STRCPY; fn++) {
+		for (i=0; i<NLENGTHS; i++) {
+			len = lengths[i];
+			iters = scale * 1024 * 1024 / len;
+			bytes = (uint64_t)iters * len;
+			for (j=0; j<NALIGNS; j++) {
+				/* strlen and strchr only use A. */
+				if ((fn == W_STRLEN || fn == W_STRCHR) &&
+				    aligns[j].aoff == 0 &&
+				    aligns[j].boff != 0) {
+					continue;
+				}
+				a = mkstring(abuf, aligns[j].aoff, len);
+				b = mkstring(bbuf, aligns[j].boff, len);
+
+				if (strlen(a) != ref_strlen(a) ||
+				    strcmp(a, b) != ref_strcmp(a, b) ||
+				    strchr(a, '!') != ref_strchr(a, '!') ||
+				    strcmp(strcpy(b, a), a) != 0) {
+					errx(1, "%s: wrong result for length "
+					     "%lu, offsets %u/%u", names[fn],
+					     (unsigned long)len,
+					     aligns[j].aoff, aligns[j].boff);
+				}
+
+				oldns = timeit(fn, true, a, b, iters);
+				newns = timeit(fn, false, a, b, iters);
+				printf("%-8s %6lu   %u/%u %9lu %9lu\n",
+				       names[fn], (unsigned long)len,
+				       aligns[j].aoff, aligns[j].boff,
+				       rate(bytes, oldns), rate(bytes, newns));
+			}
+		}
+	}
+	return 0;
+}